@@ -0,0 +1,814 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <locale>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "avl_algorithms.hpp"
+
+namespace at {
+namespace detail {
+// What operator-> of an iterator returns if its reference is a proxy object.
+template<typename Reference>
+class ArrowProxy {
+public:
+  explicit ArrowProxy(Reference reference) : m_reference{reference}
+  {
+  }
+
+  Reference* operator->()
+  {
+    return &m_reference;
+  }
+
+private:
+  Reference m_reference;
+};
+} // namespace detail
+
+/*!
+ * AVL tree that keeps its nodes in contiguous arrays instead of allocating
+ * every node on its own.
+ * Nodes are linked by 32 bit indices, a node costs 16 bytes of links.
+ * Keys, mapped values and links are stored in three separate columns,
+ * so that find only ever touches the links and the keys.
+ * As the tree contains no pointers it can be copied like a vector and
+ * its columns can be written out as they are.
+ * Like with std::flat_map the iterators return pairs of references.
+ * Erasing an element moves the element stored last into its place,
+ * which invalidates the iterators to both of them.
+ * Inserting may reallocate the columns, which invalidates references
+ * but no iterators.
+ */
+template<
+  typename Key,
+  typename T,
+  typename Compare   = std::less<Key>,
+  typename Allocator = std::allocator<std::pair<Key, T>>>
+class ArrayAvlTree {
+public:
+  using this_type       = ArrayAvlTree;
+  using key_type        = Key;
+  using mapped_type     = T;
+  using value_type      = std::pair<key_type, mapped_type>;
+  using size_type       = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using key_compare     = Compare;
+  using reference       = std::pair<const key_type&, mapped_type&>;
+  using const_reference = std::pair<const key_type&, const mapped_type&>;
+  using allocator_type  = Allocator;
+  using index_type      = std::uint32_t;
+
+  static_assert(
+    !std::is_same_v<key_type, bool> && !std::is_same_v<mapped_type, bool>,
+    "ArrayAvlTree: std::vector<bool> can't be used as a column.");
+
+  class const_iterator;
+
+private:
+  static constexpr index_type nullIndex{
+    std::numeric_limits<index_type>::max()};
+
+  struct Slot {
+    index_type   left;
+    index_type   right;
+    index_type   parent;
+    std::int32_t balance;
+  };
+
+  static_assert(sizeof(Slot) == 16, "ArrayAvlTree: unexpected padding.");
+
+  template<typename Ty>
+  using column_type = std::vector<
+    Ty,
+    typename std::allocator_traits<allocator_type>::template rebind_alloc<Ty>>;
+
+  struct Links {
+    using handle = index_type;
+
+    static constexpr handle null{nullIndex};
+
+    handle parent(handle node) const
+    {
+      return tree->m_slots[node].parent;
+    }
+
+    handle left(handle node) const
+    {
+      return tree->m_slots[node].left;
+    }
+
+    void setLeft(handle node, handle left) const
+    {
+      tree->m_slots[node].left = left;
+    }
+
+    handle right(handle node) const
+    {
+      return tree->m_slots[node].right;
+    }
+
+    void setRight(handle node, handle right) const
+    {
+      tree->m_slots[node].right = right;
+    }
+
+    void setParent(handle node, handle parent) const
+    {
+      tree->m_slots[node].parent = parent;
+    }
+
+    int balance(handle node) const
+    {
+      return tree->m_slots[node].balance;
+    }
+
+    void setBalance(handle node, int balance) const
+    {
+      tree->m_slots[node].balance = balance;
+    }
+
+    const key_type& key(handle node) const
+    {
+      return tree->m_keys[node];
+    }
+
+    // Goes through the tree as inserting may reallocate the columns.
+    this_type* tree;
+  };
+
+  using Algorithms = detail::AvlAlgorithms<Links>;
+
+public:
+  class iterator {
+  public:
+    using difference_type   = typename ArrayAvlTree::difference_type;
+    using value_type        = typename ArrayAvlTree::value_type;
+    using reference         = typename ArrayAvlTree::reference;
+    using pointer           = detail::ArrowProxy<reference>;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using iterator_concept  = std::bidirectional_iterator_tag; // C++20
+
+    friend class ArrayAvlTree;
+
+    friend bool operator==(const iterator& lhs, const iterator& rhs)
+    {
+      return lhs.m_index == rhs.m_index;
+    }
+
+    friend bool operator!=(const iterator& lhs, const iterator& rhs)
+    {
+      return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const iterator& it)
+    {
+      return os << "ArrayAvlTree::iterator{" << it.m_index << '}';
+    }
+
+    iterator() : m_tree{nullptr}, m_index{nullIndex}
+    {
+    }
+
+    reference operator*() const
+    {
+      return reference{m_tree->m_keys[m_index], m_tree->m_values[m_index]};
+    }
+
+    pointer operator->() const
+    {
+      return pointer{**this};
+    }
+
+    iterator& operator++() // prefix increment
+    {
+      if (m_index == nullIndex) {
+        throw std::runtime_error{
+          "ArrayAvlTree::iterator: prefix increment called on end iterator!"};
+      }
+
+      m_index = m_tree->algorithms().next(m_index);
+      return *this;
+    }
+
+    iterator operator++(int) // postfix increment
+    {
+      iterator it{*this};
+      ++(*this);
+      return it;
+    }
+
+    iterator& operator--() // prefix decrement
+    {
+      // Decrement end.
+      if (m_index == nullIndex) {
+        m_index = m_tree->algorithms().rightmost(m_tree->m_root);
+        return *this;
+      }
+
+      m_index = m_tree->algorithms().previous(m_index);
+      return *this;
+    }
+
+    iterator operator--(int) // postfix decrement
+    {
+      iterator it{*this};
+      --(*this);
+      return it;
+    }
+
+  private:
+    iterator(this_type* tree, index_type index) : m_tree{tree}, m_index{index}
+    {
+    }
+
+    this_type* m_tree;
+    index_type m_index;
+  };
+
+  class const_iterator {
+  public:
+    using difference_type   = typename ArrayAvlTree::difference_type;
+    using value_type        = typename ArrayAvlTree::value_type;
+    using reference         = typename ArrayAvlTree::const_reference;
+    using pointer           = detail::ArrowProxy<reference>;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using iterator_concept  = std::bidirectional_iterator_tag; // C++20
+
+    friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+    {
+      return lhs.m_it == rhs.m_it;
+    }
+
+    friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+    {
+      return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const const_iterator& it)
+    {
+      return os << "ArrayAvlTree::const_iterator{" << it.m_it.m_index << '}';
+    }
+
+    const_iterator() : m_it{}
+    {
+    }
+
+    /* IMPLICIT */ const_iterator(iterator it) : m_it{it}
+    {
+    }
+
+    reference operator*() const
+    {
+      return reference{*m_it};
+    }
+
+    pointer operator->() const
+    {
+      return pointer{**this};
+    }
+
+    const_iterator& operator++() // prefix increment
+    {
+      ++m_it;
+      return *this;
+    }
+
+    const_iterator operator++(int) // postfix increment
+    {
+      const_iterator it{*this};
+      ++(*this);
+      return it;
+    }
+
+    const_iterator& operator--() // prefix decrement
+    {
+      --m_it;
+      return *this;
+    }
+
+    const_iterator operator--(int) // postfix decrement
+    {
+      const_iterator it{*this};
+      --(*this);
+      return it;
+    }
+
+  private:
+    iterator m_it;
+  };
+
+  using reverse_iterator       = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  friend std::ostream& operator<<(std::ostream& os, const this_type& tree)
+  {
+    if (tree.empty()) {
+      return os << "Empty ArrayAvlTree";
+    }
+
+    std::ostringstream outputStringStream{};
+    outputStringStream.imbue(std::locale::classic());
+    const_cast<this_type&>(tree).algorithms().printTree(
+      tree.m_root,
+      0,
+      outputStringStream,
+      [&tree](std::ostream& os, index_type node) {
+        os << tree.m_keys[node] << " => " << tree.m_values[node];
+      });
+    std::string string{outputStringStream.str()};
+
+    for (int i{0}; i < 5; ++i) {
+      string.pop_back();
+    }
+
+    os << string;
+    return os;
+  }
+
+  ArrayAvlTree() : ArrayAvlTree{key_compare{}}
+  {
+  }
+
+  explicit ArrayAvlTree(
+    const key_compare&    compare,
+    const allocator_type& allocator = allocator_type{})
+    : m_slots{allocator}
+    , m_keys{allocator}
+    , m_values{allocator}
+    , m_root{nullIndex}
+    , m_compare{compare}
+  {
+  }
+
+  explicit ArrayAvlTree(const allocator_type& allocator)
+    : ArrayAvlTree{key_compare{}, allocator}
+  {
+  }
+
+  template<std::input_iterator InputIterator>
+  ArrayAvlTree(
+    InputIterator         first,
+    InputIterator         last,
+    const key_compare&    compare   = key_compare{},
+    const allocator_type& allocator = allocator_type{})
+    : ArrayAvlTree{compare, allocator}
+  {
+    insert(first, last);
+  }
+
+  template<std::input_iterator InputIterator>
+  ArrayAvlTree(
+    InputIterator         first,
+    InputIterator         last,
+    const allocator_type& allocator)
+    : ArrayAvlTree{first, last, key_compare{}, allocator}
+  {
+  }
+
+  ArrayAvlTree(
+    std::initializer_list<value_type> initList,
+    const key_compare&                compare   = key_compare{},
+    const allocator_type&             allocator = allocator_type{})
+    : ArrayAvlTree{initList.begin(), initList.end(), compare, allocator}
+  {
+  }
+
+  ArrayAvlTree(
+    std::initializer_list<value_type> initList,
+    const allocator_type&             allocator)
+    : ArrayAvlTree{initList, key_compare{}, allocator}
+  {
+  }
+
+  // The columns are copied as they are, no node is visited.
+  ArrayAvlTree(const this_type& other) = default;
+
+  ArrayAvlTree(const this_type& other, const allocator_type& allocator)
+    : m_slots{other.m_slots, allocator}
+    , m_keys{other.m_keys, allocator}
+    , m_values{other.m_values, allocator}
+    , m_root{other.m_root}
+    , m_compare{other.m_compare}
+  {
+  }
+
+  ArrayAvlTree(this_type&& other) noexcept
+    : m_slots{std::move(other.m_slots)}
+    , m_keys{std::move(other.m_keys)}
+    , m_values{std::move(other.m_values)}
+    , m_root{other.m_root}
+    , m_compare{std::move(other.m_compare)}
+  {
+    other.clear();
+  }
+
+  this_type& operator=(const this_type& other) = default;
+
+  this_type& operator=(this_type&& other) noexcept(
+    std::is_nothrow_move_assignable_v<column_type<Slot>>
+    && std::is_nothrow_move_assignable_v<column_type<key_type>>
+    && std::is_nothrow_move_assignable_v<column_type<mapped_type>>)
+  {
+    if (this == &other) {
+      return *this;
+    }
+
+    m_slots   = std::move(other.m_slots);
+    m_keys    = std::move(other.m_keys);
+    m_values  = std::move(other.m_values);
+    m_root    = other.m_root;
+    m_compare = std::move(other.m_compare);
+    other.clear();
+    return *this;
+  }
+
+  this_type& operator=(std::initializer_list<value_type> initList)
+  {
+    clear();
+    insert(initList);
+    return *this;
+  }
+
+  allocator_type get_allocator() const
+  {
+    return allocator_type{m_keys.get_allocator()};
+  }
+
+  key_compare key_comp() const
+  {
+    return m_compare;
+  }
+
+  size_type size() const
+  {
+    return m_keys.size();
+  }
+
+  [[nodiscard]] bool empty() const
+  {
+    return size() == 0;
+  }
+
+  size_type max_size() const
+  {
+    return nullIndex;
+  }
+
+  size_type capacity() const
+  {
+    return std::min(
+      {m_slots.capacity(), m_keys.capacity(), m_values.capacity()});
+  }
+
+  void reserve(size_type count)
+  {
+    m_slots.reserve(count);
+    m_keys.reserve(count);
+    m_values.reserve(count);
+  }
+
+  void shrink_to_fit()
+  {
+    m_slots.shrink_to_fit();
+    m_keys.shrink_to_fit();
+    m_values.shrink_to_fit();
+  }
+
+  iterator begin()
+  {
+    if (empty()) {
+      return end();
+    }
+
+    return iterator{this, algorithms().leftmost(m_root)};
+  }
+
+  const_iterator begin() const
+  {
+    return const_iterator{const_cast<this_type*>(this)->begin()};
+  }
+
+  const_iterator cbegin() const
+  {
+    return begin();
+  }
+
+  iterator end()
+  {
+    return iterator{this, nullIndex};
+  }
+
+  const_iterator end() const
+  {
+    return const_iterator{const_cast<this_type*>(this)->end()};
+  }
+
+  const_iterator cend() const
+  {
+    return end();
+  }
+
+  reverse_iterator rbegin()
+  {
+    return reverse_iterator{end()};
+  }
+
+  const_reverse_iterator rbegin() const
+  {
+    return const_reverse_iterator{const_cast<this_type*>(this)->rbegin()};
+  }
+
+  const_reverse_iterator crbegin() const
+  {
+    return rbegin();
+  }
+
+  reverse_iterator rend()
+  {
+    return reverse_iterator{begin()};
+  }
+
+  const_reverse_iterator rend() const
+  {
+    return const_cast<this_type*>(this)->rend();
+  }
+
+  const_reverse_iterator crend() const
+  {
+    return rend();
+  }
+
+  void clear()
+  {
+    m_slots.clear();
+    m_keys.clear();
+    m_values.clear();
+    m_root = nullIndex;
+  }
+
+  template<typename KeyType, typename Mapped>
+    requires std::is_constructible_v<key_type, KeyType&&>
+             && std::is_constructible_v<mapped_type, Mapped&&>
+  std::pair<iterator, bool> insert(KeyType&& key, Mapped&& value)
+  {
+    return try_emplace(
+      std::forward<KeyType>(key), std::forward<Mapped>(value));
+  }
+
+  std::pair<iterator, bool> insert(const value_type& keyValuePair)
+  {
+    return try_emplace(keyValuePair.first, keyValuePair.second);
+  }
+
+  std::pair<iterator, bool> insert(value_type&& keyValuePair)
+  {
+    return try_emplace(
+      std::move(keyValuePair.first), std::move(keyValuePair.second));
+  }
+
+  template<std::input_iterator InputIterator>
+  void insert(InputIterator first, InputIterator last)
+  {
+    while (first != last) {
+      insert(*first);
+      ++first;
+    }
+  }
+
+  void insert(std::initializer_list<value_type> initList)
+  {
+    insert(initList.begin(), initList.end());
+  }
+
+  template<typename Mapped>
+  std::pair<iterator, bool> insert_or_assign(
+    const key_type& key,
+    Mapped&&        value)
+  {
+    return insertOrAssign(key, std::forward<Mapped>(value));
+  }
+
+  template<typename Mapped>
+  std::pair<iterator, bool> insert_or_assign(key_type&& key, Mapped&& value)
+  {
+    return insertOrAssign(std::move(key), std::forward<Mapped>(value));
+  }
+
+  /*!
+   * Constructs the element from args and moves it into the columns
+   * if its key is not present yet.
+   */
+  template<typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args)
+  {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+
+  /*!
+   * Constructs the mapped value from args in place if key is not present.
+   * Otherwise nothing happens, args are not moved from in that case.
+   */
+  template<typename... Args>
+  std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args)
+  {
+    return insertNode(key, [&] {
+      return appendNode(key, std::forward<Args>(args)...);
+    });
+  }
+
+  template<typename... Args>
+  std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args)
+  {
+    return insertNode(key, [&] {
+      return appendNode(std::move(key), std::forward<Args>(args)...);
+    });
+  }
+
+  iterator erase(const key_type& key)
+  {
+    index_type erased{nullIndex};
+    index_type next{nullIndex};
+    m_root = algorithms().detach(m_root, key, m_compare, &erased, &next);
+
+    if (erased == nullIndex) {
+      return end();
+    }
+
+    return iterator{this, removeNode(erased, next)};
+  }
+
+  void swap(this_type& other) noexcept
+  {
+    using std::swap;
+    swap(m_slots, other.m_slots);
+    swap(m_keys, other.m_keys);
+    swap(m_values, other.m_values);
+    swap(m_root, other.m_root);
+    swap(m_compare, other.m_compare);
+  }
+
+  iterator find(const key_type& key)
+  {
+    const Slot*     slots{m_slots.data()};
+    const key_type* keys{m_keys.data()};
+    index_type      node{m_root};
+
+    while (node != nullIndex) {
+      const int direction{detail::compareThreeWay(m_compare, key, keys[node])};
+
+      if (direction < 0) { // If key < node.key -> go left.
+        node = slots[node].left;
+      }
+      else if (direction > 0) { // If key > node.key -> go right.
+        node = slots[node].right;
+      }
+      else { // Found it.
+        return iterator{this, node};
+      }
+    }
+
+    return end();
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    return const_cast<this_type*>(this)->find(key);
+  }
+
+private:
+  Algorithms algorithms()
+  {
+    return Algorithms{Links{this}};
+  }
+
+  // Appends a node to the columns and returns its index.
+  template<typename KeyType, typename... Args>
+  index_type appendNode(KeyType&& key, Args&&... args)
+  {
+    if (size() == max_size()) {
+      throw std::length_error{"ArrayAvlTree: too many elements."};
+    }
+
+    const auto index{static_cast<index_type>(size())};
+    m_keys.emplace_back(std::forward<KeyType>(key));
+
+    try {
+      m_values.emplace_back(std::forward<Args>(args)...);
+
+      try {
+        m_slots.push_back(Slot{nullIndex, nullIndex, nullIndex, 0});
+      }
+      catch (...) {
+        m_values.pop_back();
+        throw;
+      }
+    }
+    catch (...) {
+      m_keys.pop_back();
+      throw;
+    }
+
+    return index;
+  }
+
+  // Moves the node stored last into the place of the erased node,
+  // so that the columns stay dense. Returns where next ends up.
+  index_type removeNode(index_type erased, index_type next)
+  {
+    const auto last{static_cast<index_type>(size() - 1)};
+
+    if (erased != last) {
+      const Slot moved{m_slots[last]};
+
+      if (moved.parent == nullIndex) {
+        m_root = erased;
+      }
+      else if (m_slots[moved.parent].left == last) {
+        m_slots[moved.parent].left = erased;
+      }
+      else {
+        m_slots[moved.parent].right = erased;
+      }
+
+      if (moved.left != nullIndex) {
+        m_slots[moved.left].parent = erased;
+      }
+
+      if (moved.right != nullIndex) {
+        m_slots[moved.right].parent = erased;
+      }
+
+      m_slots[erased]  = moved;
+      m_keys[erased]   = std::move(m_keys[last]);
+      m_values[erased] = std::move(m_values[last]);
+
+      if (next == last) {
+        next = erased;
+      }
+    }
+
+    m_slots.pop_back();
+    m_keys.pop_back();
+    m_values.pop_back();
+    return next;
+  }
+
+  template<typename KeyType, typename Mapped>
+  std::pair<iterator, bool> insertOrAssign(KeyType&& key, Mapped&& value)
+  {
+    std::pair<iterator, bool> result{insertNode(key, [&] {
+      return appendNode(
+        std::forward<KeyType>(key), std::forward<Mapped>(value));
+    })};
+
+    if (!result.second) {
+      m_values[result.first.m_index] = std::forward<Mapped>(value);
+    }
+
+    return result;
+  }
+
+  // Inserts the node returned by createNode unless key is already present,
+  // createNode is only called if a node is to be inserted.
+  template<typename CreateNode>
+  std::pair<iterator, bool> insertNode(
+    const key_type& key,
+    CreateNode&&    createNode)
+  {
+    const size_type nodeCount{size()};
+    index_type      nodeInserted{nullIndex};
+    m_root = algorithms().insert(
+      m_root, key, m_compare, createNode, &nodeInserted);
+
+    return {iterator{this, nodeInserted}, size() != nodeCount};
+  }
+
+  column_type<Slot>                 m_slots;
+  column_type<key_type>             m_keys;
+  column_type<mapped_type>          m_values;
+  index_type                        m_root;
+  [[no_unique_address]] key_compare m_compare;
+};
+
+template<typename Key, typename T, typename Compare, typename Allocator>
+void swap(
+  ArrayAvlTree<Key, T, Compare, Allocator>& lhs,
+  ArrayAvlTree<Key, T, Compare, Allocator>& rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+} // namespace at
@@ -0,0 +1,1376 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <compare>
+#include <concepts>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace at {
+namespace detail {
+// The balance factor (height of the left subtree - height of the right
+// subtree) of a node is kept in the two low bits of one of its links,
+// which are always zero as nodes are at least 4 byte aligned.
+inline constexpr std::uintptr_t balanceMask{0b11};
+
+template<typename Node>
+Node* linkedNode(std::uintptr_t link)
+{
+  return reinterpret_cast<Node*>(link & ~balanceMask);
+}
+
+inline int linkedBalance(std::uintptr_t link)
+{
+  const std::uintptr_t bits{link & balanceMask};
+  return bits == balanceMask ? -1 : static_cast<int>(bits);
+}
+
+inline std::uintptr_t withNode(std::uintptr_t link, const void* node)
+{
+  return reinterpret_cast<std::uintptr_t>(node) | (link & balanceMask);
+}
+
+inline std::uintptr_t withBalance(std::uintptr_t link, int balance)
+{
+  return (link & ~balanceMask)
+         | (static_cast<std::uintptr_t>(balance) & balanceMask);
+}
+
+template<typename Node, bool ParentLinks>
+class NodeLinks;
+
+template<typename Node>
+class NodeLinks<Node, true> {
+public:
+  NodeLinks() : m_parentAndBalance{0}, m_left{nullptr}, m_right{nullptr}
+  {
+  }
+
+  Node* parent() const
+  {
+    return linkedNode<Node>(m_parentAndBalance);
+  }
+
+  void setParent(Node* parent)
+  {
+    m_parentAndBalance = withNode(m_parentAndBalance, parent);
+  }
+
+  Node* left() const
+  {
+    return m_left;
+  }
+
+  void setLeft(Node* left)
+  {
+    m_left = left;
+  }
+
+  Node* right() const
+  {
+    return m_right;
+  }
+
+  void setRight(Node* right)
+  {
+    m_right = right;
+  }
+
+  int balance() const
+  {
+    return linkedBalance(m_parentAndBalance);
+  }
+
+  void setBalance(int balance)
+  {
+    m_parentAndBalance = withBalance(m_parentAndBalance, balance);
+  }
+
+private:
+  std::uintptr_t m_parentAndBalance;
+  Node*          m_left;
+  Node*          m_right;
+};
+
+template<typename Node>
+class NodeLinks<Node, false> {
+public:
+  NodeLinks() : m_leftAndBalance{0}, m_right{nullptr}
+  {
+  }
+
+  void setParent(Node*)
+  {
+    // There is no parent link to keep up to date.
+  }
+
+  Node* left() const
+  {
+    return linkedNode<Node>(m_leftAndBalance);
+  }
+
+  void setLeft(Node* left)
+  {
+    m_leftAndBalance = withNode(m_leftAndBalance, left);
+  }
+
+  Node* right() const
+  {
+    return m_right;
+  }
+
+  void setRight(Node* right)
+  {
+    m_right = right;
+  }
+
+  int balance() const
+  {
+    return linkedBalance(m_leftAndBalance);
+  }
+
+  void setBalance(int balance)
+  {
+    m_leftAndBalance = withBalance(m_leftAndBalance, balance);
+  }
+
+private:
+  std::uintptr_t m_leftAndBalance;
+  Node*          m_right;
+};
+
+// Comparators may offer a three-way comparison as compare3(lhs, rhs),
+// which returns a value that compares to 0 like lhs <=> rhs.
+template<typename Less, typename Lhs, typename Rhs>
+concept HasCompare3 = requires(
+  const Less& less,
+  const Lhs&  lhs,
+  const Rhs&  rhs) {
+  { less.compare3(lhs, rhs) < 0 } -> std::convertible_to<bool>;
+  { less.compare3(lhs, rhs) > 0 } -> std::convertible_to<bool>;
+};
+
+template<typename Ty>
+struct IsStandardString : std::false_type {
+};
+
+template<typename Char>
+struct IsStandardString<
+  std::basic_string<Char, std::char_traits<Char>, std::allocator<Char>>>
+  : std::true_type {
+};
+
+template<typename Char>
+struct IsStandardString<std::basic_string_view<Char, std::char_traits<Char>>>
+  : std::true_type {
+};
+
+// Types whose std::less users can't specialize and whose < orders the same
+// as std::compare_three_way, which unlike <=> gives pointers a total order.
+template<typename Ty>
+concept OrderedLikeSpaceship
+  = std::is_arithmetic_v<Ty> || std::is_pointer_v<Ty>
+    || IsStandardString<Ty>::value;
+
+template<typename Less, typename Lhs, typename Rhs>
+concept LessAgreesWithSpaceship
+  = (std::same_as<Less, std::less<>>
+     || (std::same_as<Less, std::less<Lhs>> && std::same_as<Lhs, Rhs>))
+    && OrderedLikeSpaceship<Lhs> && OrderedLikeSpaceship<Rhs>
+    && std::three_way_comparable_with<Lhs, Rhs>;
+
+// Returns whether lhs goes before (-1), after (1) or is equivalent to (0)
+// rhs with a single comparison if less allows it, with two otherwise.
+template<typename Less, typename Lhs, typename Rhs>
+int compareThreeWay(const Less& less, const Lhs& lhs, const Rhs& rhs)
+{
+  if constexpr (HasCompare3<Less, Lhs, Rhs>) {
+    const auto order{less.compare3(lhs, rhs)};
+    return order < 0 ? -1 : (order > 0 ? 1 : 0);
+  }
+  else if constexpr (LessAgreesWithSpaceship<Less, Lhs, Rhs>) {
+    const auto order{std::compare_three_way{}(lhs, rhs)};
+    return order < 0 ? -1 : (order > 0 ? 1 : 0);
+  }
+  else {
+    if (less(lhs, rhs)) {
+      return -1;
+    }
+
+    return less(rhs, lhs) ? 1 : 0;
+  }
+}
+
+// Upper bound for the height of an AVL tree with up to SIZE_MAX nodes.
+// The sparsest AVL tree of height h has sparsest(h - 1) + sparsest(h - 2) + 1
+// nodes, which puts the bound at about 1.44 * log2(SIZE_MAX).
+constexpr std::size_t maximumHeight()
+{
+  constexpr std::size_t maximumNodeCount{static_cast<std::size_t>(-1)};
+  std::size_t           sparser{0};
+  std::size_t           sparsest{1};
+  std::size_t           height{1};
+
+  while (sparsest <= maximumNodeCount - sparser - 1) {
+    const std::size_t next{sparsest + sparser + 1};
+    sparser  = sparsest;
+    sparsest = next;
+    ++height;
+  }
+
+  return height;
+}
+
+// Path from the root of a tree down to one of its nodes.
+template<typename Node>
+class NodePath {
+public:
+  NodePath() : m_size{0}
+  {
+  }
+
+  // Only copy the part of the array that is in use.
+  NodePath(const NodePath& other) : m_size{other.m_size}
+  {
+    std::copy_n(other.m_nodes.begin(), m_size, m_nodes.begin());
+  }
+
+  NodePath& operator=(const NodePath& other)
+  {
+    m_size = other.m_size;
+    std::copy_n(other.m_nodes.begin(), m_size, m_nodes.begin());
+    return *this;
+  }
+
+  bool empty() const
+  {
+    return m_size == 0;
+  }
+
+  Node* top() const
+  {
+    return m_nodes[m_size - 1];
+  }
+
+  void push(Node* node)
+  {
+    m_nodes[m_size] = node;
+    ++m_size;
+  }
+
+  void pop()
+  {
+    --m_size;
+  }
+
+private:
+  std::array<Node*, maximumHeight()> m_nodes;
+  std::size_t                        m_size;
+};
+
+struct Empty {
+};
+
+// Links of the nodes of an AvlTree, which are reached through plain pointers.
+template<typename Node>
+struct NodePointerLinks {
+  using handle = Node*;
+
+  static constexpr handle null{nullptr};
+
+  handle parent(handle node) const
+  {
+    return node->parent();
+  }
+
+  handle left(handle node) const
+  {
+    return node->left();
+  }
+
+  void setLeft(handle node, handle left) const
+  {
+    node->setLeft(left);
+  }
+
+  handle right(handle node) const
+  {
+    return node->right();
+  }
+
+  void setRight(handle node, handle right) const
+  {
+    node->setRight(right);
+  }
+
+  void setParent(handle node, handle parent) const
+  {
+    node->setParent(parent);
+  }
+
+  int balance(handle node) const
+  {
+    return node->balance();
+  }
+
+  void setBalance(handle node, int balance) const
+  {
+    node->setBalance(balance);
+  }
+
+  decltype(auto) key(handle node) const
+  {
+    return node->key();
+  }
+};
+
+/*!
+ * The insertion, erasure and rebalancing logic shared by the AVL trees.
+ * Links decides how nodes are represented: its handle type refers to a node,
+ * null to no node at all, and its member functions read and write the links,
+ * the balance factor (left height - right height) and the key of a node.
+ * See NodePointerLinks for an example.
+ * Parents are linked by whoever receives a subtree from these functions,
+ * so links without parent pointers may ignore setParent.
+ * Links may keep something about the whole subtree of a node in the node,
+ * like its size, which its member update(node) recomputes from node and its
+ * children. It is called for every node whose subtree changed, bottom-up.
+ * Links may also keep changes to a whole subtree pending in its root,
+ * its member push(node) hands them down to the children of node. It is called
+ * before the children of a node are looked at or relinked.
+ */
+template<typename Links>
+class AvlAlgorithms {
+public:
+  using handle = typename Links::handle;
+
+  static constexpr handle null{Links::null};
+
+  static constexpr bool augmented{
+    requires(const Links& links, handle node) { links.update(node); }};
+
+  static constexpr bool lazy{
+    requires(const Links& links, handle node) { links.push(node); }};
+
+  explicit AvlAlgorithms(Links links) : m_links{links}
+  {
+  }
+
+  /*!
+   * Inserts the node returned by createNode into the tree rooted at root
+   * unless a node with an equivalent key is present and returns the new root.
+   * createNode is only called if a node is to be inserted.
+   * *found is set to the node inserted or the one that prevented the insertion.
+   */
+  template<typename Key, typename Less, typename CreateNode>
+  handle insert(
+    handle      root,
+    const Key&  key,
+    const Less& less,
+    CreateNode& createNode,
+    handle*     found)
+  {
+    auto locate{[&](handle node) { return compare(key, node, less); }};
+    root = insertImpl(root, locate, createNode, found);
+    m_links.setParent(root, null);
+    return root;
+  }
+
+  /*!
+   * Inserts the node returned by createNode into the tree rooted at root
+   * behind all nodes with an equivalent key and returns the new root.
+   * *inserted is set to the node inserted.
+   */
+  template<typename Key, typename Less, typename CreateNode>
+  handle insertMulti(
+    handle      root,
+    const Key&  key,
+    const Less& less,
+    CreateNode& createNode,
+    handle*     inserted)
+  {
+    auto locate{[&](handle node) {
+      return less(key, m_links.key(node)) ? -1 : 1;
+    }};
+    root = insertImpl(root, locate, createNode, inserted);
+    m_links.setParent(root, null);
+    return root;
+  }
+
+  /*!
+   * Like insert, but the position is found by locate(node), see detachAt.
+   */
+  template<typename Locate, typename CreateNode>
+  handle insertAt(
+    handle      root,
+    Locate&     locate,
+    CreateNode& createNode,
+    handle*     found)
+  {
+    root = insertImpl(root, locate, createNode, found);
+    m_links.setParent(root, null);
+    return root;
+  }
+
+  /*!
+   * Links node, which has no children, as the child of parent on the side
+   * direction points to, which must be free, and returns the new root.
+   * Retraces upwards from parent without looking at any keys and stops as
+   * soon as a subtree keeps its height, which takes an amortized constant
+   * number of steps. Requires parent links.
+   */
+  handle insertBelow(handle root, handle parent, int direction, handle node)
+  {
+    update(node);
+    setChild(parent, direction, node);
+    handle child{node};
+
+    for (bool heightIncreased{true}; heightIncreased && parent != null;) {
+      const handle grandparent{m_links.parent(parent)};
+      const handle subtree{
+        m_links.left(parent) == child
+          ? leftSubtreeGrew(parent, &heightIncreased)
+          : rightSubtreeGrew(parent, &heightIncreased)};
+
+      if (subtree != parent) {
+        if (grandparent == null) {
+          root = subtree;
+          m_links.setParent(root, null);
+        }
+        else {
+          setChild(
+            grandparent,
+            m_links.left(grandparent) == parent ? -1 : 1,
+            subtree);
+        }
+      }
+
+      child  = subtree;
+      parent = grandparent;
+    }
+
+    if constexpr (augmented) {
+      for (; parent != null; parent = m_links.parent(parent)) {
+        update(parent);
+      }
+    }
+
+    return root;
+  }
+
+  /*!
+   * Unlinks the node with a key equivalent to key from the tree rooted at root
+   * and returns the new root.
+   * *detached is set to the node unlinked, *next to its in-order successor.
+   * Both are set to null if there is no such node.
+   */
+  template<typename Key, typename Less>
+  handle detach(
+    handle      root,
+    const Key&  key,
+    const Less& less,
+    handle*     detached,
+    handle*     next)
+  {
+    auto locate{[&](handle node) { return compare(key, node, less); }};
+    return detachAt(root, locate, detached, next);
+  }
+
+  /*!
+   * Like detach, but the node is found by locate(node), which tells whether
+   * it is in the left subtree of node (< 0), in the right one (> 0)
+   * or node itself (0).
+   * locate is called once per level, from the root downwards.
+   */
+  template<typename Locate>
+  handle detachAt(
+    handle  root,
+    Locate& locate,
+    handle* detached,
+    handle* next)
+  {
+    *detached = null;
+    *next     = null;
+    root      = detachImpl(root, locate, detached, next);
+
+    if (root != null) {
+      m_links.setParent(root, null);
+    }
+
+    return root;
+  }
+
+  /*!
+   * Unlinks all nodes with a key equivalent to key from the tree rooted at
+   * root in a single pass and returns the new root.
+   * detachNode(node) is called for every node unlinked, after which the
+   * node is no longer looked at.
+   * *next is set to the first node with a greater key, if any.
+   * Instead of retracing once per node the remainders left and right of
+   * the equivalent keys are joined together, which takes O(log n) steps
+   * plus one per node unlinked.
+   */
+  template<typename Key, typename Less, typename DetachNode>
+  handle detachEquivalent(
+    handle      root,
+    const Key&  key,
+    const Less& less,
+    DetachNode& detachNode,
+    handle*     next)
+  {
+    int height{0};
+    *next = null;
+    root  = detachEquivalentImpl(
+      root, heightOf(root), key, less, detachNode, null, next, &height);
+
+    if (root != null) {
+      m_links.setParent(root, null);
+    }
+
+    return root;
+  }
+
+  /*!
+   * Splits the tree rooted at root into the nodes for which goesLeft(node)
+   * holds, which have to come first in key order, and the others.
+   * *left and *right are set to the roots of both trees.
+   * Joins the subtrees cut off on the way down, which takes O(log n) steps
+   * in total as each join only makes up the difference in height.
+   */
+  template<typename GoesLeft>
+  void split(handle root, GoesLeft& goesLeft, handle* left, handle* right)
+  {
+    int leftHeight{0};
+    int rightHeight{0};
+    splitImpl(
+      root, heightOf(root), goesLeft, left, &leftHeight, right, &rightHeight);
+
+    if (*left != null) {
+      m_links.setParent(*left, null);
+    }
+
+    if (*right != null) {
+      m_links.setParent(*right, null);
+    }
+  }
+
+  /*!
+   * Joins the trees rooted at left and right, the keys of left coming first,
+   * and returns the new root. Takes O(log n) steps.
+   */
+  handle join(handle left, handle right)
+  {
+    int    height{0};
+    handle root{join(left, heightOf(left), right, heightOf(right), &height)};
+
+    if (root != null) {
+      m_links.setParent(root, null);
+    }
+
+    return root;
+  }
+
+  /*!
+   * Recomputes what Links keeps about the subtree of node, if anything.
+   * Callers that link nodes together themselves call it bottom-up.
+   */
+  void update(handle node) const
+  {
+    if constexpr (augmented) {
+      m_links.update(node);
+    }
+  }
+
+  /*!
+   * Hands the changes pending at node down to its children, if any.
+   * Callers that descend or relink nodes themselves call it top-down.
+   */
+  void push(handle node) const
+  {
+    if constexpr (lazy) {
+      m_links.push(node);
+    }
+  }
+
+  handle leftmost(handle node) const
+  {
+    while (m_links.left(node) != null) {
+      node = m_links.left(node);
+    }
+
+    return node;
+  }
+
+  handle rightmost(handle node) const
+  {
+    while (m_links.right(node) != null) {
+      node = m_links.right(node);
+    }
+
+    return node;
+  }
+
+  // Returns the in-order successor of node, requires parent links.
+  handle next(handle node) const
+  {
+    if (m_links.right(node) != null) {
+      return leftmost(m_links.right(node));
+    }
+
+    handle parent{m_links.parent(node)};
+
+    while (parent != null && node == m_links.right(parent)) {
+      node   = parent;
+      parent = m_links.parent(node);
+    }
+
+    return parent;
+  }
+
+  // Returns the in-order predecessor of node, requires parent links.
+  handle previous(handle node) const
+  {
+    if (m_links.left(node) != null) {
+      return rightmost(m_links.left(node));
+    }
+
+    handle parent{m_links.parent(node)};
+
+    while (parent != null && node == m_links.left(parent)) {
+      node   = parent;
+      parent = m_links.parent(node);
+    }
+
+    return parent;
+  }
+
+  /*!
+   * Writes the tree rooted at node sideways, the root at the left margin.
+   * printNode(os, node) writes a single node.
+   */
+  template<typename PrintNode>
+  void printTree(
+    handle           node,
+    int              depth,
+    std::ostream&    os,
+    const PrintNode& printNode) const
+  {
+    if (node == null) {
+      return;
+    }
+
+    push(node);
+    printTree(m_links.left(node), depth + 6, os, printNode);
+
+    for (int i{0}; i < depth; ++i) {
+      if (i == 0) {
+        os << '|';
+      }
+      else {
+        os << '=';
+      }
+    }
+
+    printNode(os, node);
+    os << "\n|\n|\n";
+
+    printTree(m_links.right(node), depth + 6, os, printNode);
+  }
+
+private:
+  // Returns where key lies relative to node, see detachAt.
+  template<typename Key, typename Less>
+  int compare(const Key& key, handle node, const Less& less) const
+  {
+    return compareThreeWay(less, key, m_links.key(node));
+  }
+
+  // Returns the height of the subtree rooted at node in O(log n) by walking
+  // down the higher side.
+  int heightOf(handle node) const
+  {
+    int height{0};
+
+    while (node != null) {
+      ++height;
+      node = m_links.balance(node) < 0 ? m_links.right(node)
+                                       : m_links.left(node);
+    }
+
+    return height;
+  }
+
+  // The nodes passed on the way down from the root and the side taken at
+  // each of them, which is all that walking back up needs.
+  struct DescentPath {
+    void push(handle node, int direction)
+    {
+      nodes[size]      = node;
+      directions[size] = static_cast<signed char>(direction < 0 ? -1 : 1);
+      ++size;
+    }
+
+    std::array<handle, maximumHeight()>      nodes;
+    std::array<signed char, maximumHeight()> directions;
+    std::size_t                              size{0};
+  };
+
+  // Links child to parent on the side direction points to.
+  void setChild(handle parent, int direction, handle child)
+  {
+    if (direction < 0) {
+      m_links.setLeft(parent, child);
+    }
+    else {
+      m_links.setRight(parent, child);
+    }
+
+    if (child != null) {
+      m_links.setParent(child, parent);
+    }
+  }
+
+  // Puts subtree in the place of the node at index of path.
+  void replaceOnPath(
+    const DescentPath& path,
+    std::size_t        index,
+    handle             subtree,
+    handle*            root)
+  {
+    if (index == 0) {
+      *root = subtree;
+      return;
+    }
+
+    setChild(path.nodes[index - 1], path.directions[index - 1], subtree);
+  }
+
+  // Updates the first size nodes of path bottom-up, which is left to do
+  // once retracing stopped early.
+  void updatePath(const DescentPath& path, std::size_t size) const
+  {
+    if constexpr (augmented) {
+      while (size != 0) {
+        --size;
+        update(path.nodes[size]);
+      }
+    }
+  }
+
+  // Descends without recursion, then retraces bottom-up and stops as soon
+  // as a subtree keeps its height, which after an insertion is the latest
+  // after the first rotation.
+  template<typename Locate, typename CreateNode>
+  handle insertImpl(
+    handle      root,
+    Locate&     locate,
+    CreateNode& createNode,
+    handle*     insertedOrPreventedInsertion)
+  {
+    DescentPath path;
+    handle      node{root};
+
+    while (node != null) {
+      push(node);
+      const int direction{locate(node)};
+
+      if (direction == 0) { // It's already there.
+        *insertedOrPreventedInsertion = node;
+        return root;
+      }
+
+      path.push(node, direction);
+      node = direction < 0 ? m_links.left(node) : m_links.right(node);
+    }
+
+    // Leaf position found -> put the new node there.
+    const handle nodeCreated{createNode()};
+    *insertedOrPreventedInsertion = nodeCreated;
+    update(nodeCreated);
+    replaceOnPath(path, path.size, nodeCreated, &root);
+
+    for (bool heightIncreased{true}; heightIncreased && path.size != 0;) {
+      --path.size;
+      const handle parent{path.nodes[path.size]};
+      const handle subtree{
+        path.directions[path.size] < 0
+          ? leftSubtreeGrew(parent, &heightIncreased)
+          : rightSubtreeGrew(parent, &heightIncreased)};
+
+      if (subtree != parent) {
+        replaceOnPath(path, path.size, subtree, &root);
+      }
+    }
+
+    updatePath(path, path.size);
+    return root;
+  }
+
+  template<typename Locate>
+  handle detachImpl(
+    handle  root,
+    Locate& locate,
+    handle* detached,
+    handle* next)
+  {
+    DescentPath path;
+    handle      successor{null}; // The closest ancestor with a greater key.
+    handle      node{root};
+
+    for (;;) {
+      if (node == null) {
+        return root;
+      }
+
+      push(node);
+      const int direction{locate(node)};
+
+      if (direction == 0) {
+        break;
+      }
+
+      if (direction < 0) {
+        successor = node;
+      }
+
+      path.push(node, direction);
+      node = direction < 0 ? m_links.left(node) : m_links.right(node);
+    }
+
+    *detached = node;
+    const handle left{m_links.left(node)};
+    const handle right{m_links.right(node)};
+
+    if (left == null || right == null) {
+      // One child or no children, the child takes the place of node.
+      *next = right != null ? right : successor;
+      replaceOnPath(path, path.size, left != null ? left : right, &root);
+    }
+    else {
+      // Two children, the in-order successor takes the place of node.
+      const std::size_t index{path.size};
+      path.push(node, 1);
+      handle replacement{right};
+      push(replacement);
+
+      while (m_links.left(replacement) != null) {
+        path.push(replacement, -1);
+        replacement = m_links.left(replacement);
+        push(replacement);
+      }
+
+      *next = replacement;
+      setChild(
+        path.nodes[path.size - 1],
+        path.directions[path.size - 1],
+        m_links.right(replacement));
+
+      m_links.setLeft(replacement, left);
+      m_links.setParent(left, replacement);
+      // Read again, as it changed if replacement was the right child.
+      setChild(replacement, 1, m_links.right(node));
+      m_links.setBalance(replacement, m_links.balance(node));
+      path.nodes[index] = replacement;
+      replaceOnPath(path, index, replacement, &root);
+    }
+
+    for (bool heightDecreased{true}; heightDecreased && path.size != 0;) {
+      --path.size;
+      const handle parent{path.nodes[path.size]};
+      const handle subtree{
+        path.directions[path.size] < 0
+          ? leftSubtreeShrunk(parent, &heightDecreased)
+          : rightSubtreeShrunk(parent, &heightDecreased)};
+
+      if (subtree != parent) {
+        replaceOnPath(path, path.size, subtree, &root);
+      }
+    }
+
+    updatePath(path, path.size);
+    return root;
+  }
+
+  // Detaches the nodes with a key equivalent to key from the subtree of the
+  // given height rooted at node, returns the remainder and its height.
+  // next is null in subtrees that only hold keys up to key.
+  template<typename Key, typename Less, typename DetachNode>
+  handle detachEquivalentImpl(
+    handle      node,
+    int         height,
+    const Key&  key,
+    const Less& less,
+    DetachNode& detachNode,
+    handle      successor,
+    handle*     next,
+    int*        remainderHeight)
+  {
+    if (node == null) {
+      if (next != nullptr) {
+        *next = successor;
+      }
+
+      *remainderHeight = 0;
+      return null;
+    }
+
+    push(node);
+    const handle left{m_links.left(node)};
+    const handle right{m_links.right(node)};
+    const int    leftHeight{height - (m_links.balance(node) < 0 ? 2 : 1)};
+    const int    rightHeight{height - (m_links.balance(node) > 0 ? 2 : 1)};
+    int          leftRemainderHeight{0};
+    int          rightRemainderHeight{0};
+
+    const int direction{compare(key, node, less)};
+
+    if (direction > 0) {
+      const handle rightRemainder{detachEquivalentImpl(
+        right,
+        rightHeight,
+        key,
+        less,
+        detachNode,
+        successor,
+        next,
+        &rightRemainderHeight)};
+      return join(
+        left,
+        leftHeight,
+        node,
+        rightRemainder,
+        rightRemainderHeight,
+        remainderHeight);
+    }
+
+    if (direction < 0) {
+      const handle leftRemainder{detachEquivalentImpl(
+        left,
+        leftHeight,
+        key,
+        less,
+        detachNode,
+        node,
+        next,
+        &leftRemainderHeight)};
+      return join(
+        leftRemainder,
+        leftRemainderHeight,
+        node,
+        right,
+        rightHeight,
+        remainderHeight);
+    }
+
+    // Equivalent keys continue into both subtrees. Below the first such
+    // node one of the remainders is always empty, so only one real join
+    // takes place.
+    const handle leftRemainder{detachEquivalentImpl(
+      left,
+      leftHeight,
+      key,
+      less,
+      detachNode,
+      null,
+      nullptr,
+      &leftRemainderHeight)};
+    const handle rightRemainder{detachEquivalentImpl(
+      right,
+      rightHeight,
+      key,
+      less,
+      detachNode,
+      successor,
+      next,
+      &rightRemainderHeight)};
+    detachNode(node);
+    return join(
+      leftRemainder,
+      leftRemainderHeight,
+      rightRemainder,
+      rightRemainderHeight,
+      remainderHeight);
+  }
+
+  // Splits the subtree rooted at node, whose height is height, and returns
+  // both parts along with their heights.
+  template<typename GoesLeft>
+  void splitImpl(
+    handle    node,
+    int       height,
+    GoesLeft& goesLeft,
+    handle*   leftPart,
+    int*      leftPartHeight,
+    handle*   rightPart,
+    int*      rightPartHeight)
+  {
+    if (node == null) {
+      *leftPart        = null;
+      *leftPartHeight  = 0;
+      *rightPart       = null;
+      *rightPartHeight = 0;
+      return;
+    }
+
+    push(node);
+    const handle left{m_links.left(node)};
+    const handle right{m_links.right(node)};
+    const int    leftHeight{height - (m_links.balance(node) < 0 ? 2 : 1)};
+    const int    rightHeight{height - (m_links.balance(node) > 0 ? 2 : 1)};
+
+    if (goesLeft(node)) {
+      // node and everything left of it stay, the split goes on to the right.
+      splitImpl(
+        right,
+        rightHeight,
+        goesLeft,
+        leftPart,
+        leftPartHeight,
+        rightPart,
+        rightPartHeight);
+      *leftPart = join(
+        left, leftHeight, node, *leftPart, *leftPartHeight, leftPartHeight);
+    }
+    else {
+      splitImpl(
+        left,
+        leftHeight,
+        goesLeft,
+        leftPart,
+        leftPartHeight,
+        rightPart,
+        rightPartHeight);
+      *rightPart = join(
+        *rightPart,
+        *rightPartHeight,
+        node,
+        right,
+        rightHeight,
+        rightPartHeight);
+    }
+  }
+
+  // Joins the subtrees left and right, whose keys are ordered, with pivot in
+  // between and returns the result and its height.
+  // Descends along the higher subtree until the heights match, so it takes
+  // O(|leftHeight - rightHeight|) steps.
+  handle join(
+    handle left,
+    int    leftHeight,
+    handle pivot,
+    handle right,
+    int    rightHeight,
+    int*   height)
+  {
+    if (leftHeight > rightHeight + 1) {
+      push(left);
+      const int leftLeftHeight{
+        leftHeight - (m_links.balance(left) < 0 ? 2 : 1)};
+      const int leftRightHeight{
+        leftHeight - (m_links.balance(left) > 0 ? 2 : 1)};
+      int          joinedHeight{0};
+      const handle joined{join(
+        m_links.right(left),
+        leftRightHeight,
+        pivot,
+        right,
+        rightHeight,
+        &joinedHeight)};
+      m_links.setRight(left, joined);
+      m_links.setParent(joined, left);
+      return settle(left, leftLeftHeight, joinedHeight, height);
+    }
+
+    if (rightHeight > leftHeight + 1) {
+      push(right);
+      const int rightLeftHeight{
+        rightHeight - (m_links.balance(right) < 0 ? 2 : 1)};
+      const int rightRightHeight{
+        rightHeight - (m_links.balance(right) > 0 ? 2 : 1)};
+      int          joinedHeight{0};
+      const handle joined{join(
+        left,
+        leftHeight,
+        pivot,
+        m_links.left(right),
+        rightLeftHeight,
+        &joinedHeight)};
+      m_links.setLeft(right, joined);
+      m_links.setParent(joined, right);
+      return settle(right, joinedHeight, rightRightHeight, height);
+    }
+
+    push(pivot);
+    m_links.setLeft(pivot, left);
+    m_links.setRight(pivot, right);
+
+    if (left != null) {
+      m_links.setParent(left, pivot);
+    }
+
+    if (right != null) {
+      m_links.setParent(right, pivot);
+    }
+
+    m_links.setBalance(pivot, leftHeight - rightHeight);
+    update(pivot);
+    *height = std::max(leftHeight, rightHeight) + 1;
+    return pivot;
+  }
+
+  // Joins left and right without a pivot, the leftmost node of right
+  // takes that role.
+  handle join(
+    handle left,
+    int    leftHeight,
+    handle right,
+    int    rightHeight,
+    int*   height)
+  {
+    if (left == null) {
+      *height = rightHeight;
+      return right;
+    }
+
+    if (right == null) {
+      *height = leftHeight;
+      return left;
+    }
+
+    handle       pivot{null};
+    bool         heightDecreased{false};
+    const handle remainder{
+      detachLeftmostNode(right, &pivot, &heightDecreased)};
+    return join(
+      left,
+      leftHeight,
+      pivot,
+      remainder,
+      rightHeight - (heightDecreased ? 1 : 0),
+      height);
+  }
+
+  // Sets the balance factor of node from the heights of its subtrees,
+  // which may differ by 2 after a join, returns the new root of the subtree
+  // and its height.
+  handle settle(handle node, int leftHeight, int rightHeight, int* height)
+  {
+    const int balanceFactor{leftHeight - rightHeight};
+
+    if (balanceFactor == 2 || balanceFactor == -2) {
+      // Only a rotation around a balanced child leaves the height as it was.
+      const handle higher{
+        balanceFactor > 0 ? m_links.left(node) : m_links.right(node)};
+      *height = std::max(leftHeight, rightHeight)
+                + (m_links.balance(higher) == 0 ? 1 : 0);
+      return rebalance(node, balanceFactor);
+    }
+
+    m_links.setBalance(node, balanceFactor);
+    update(node);
+    *height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+  }
+
+  // Detaches the leftmost node of the subtree rooted at node and returns the
+  // rebalanced remainder of that subtree.
+  handle detachLeftmostNode(
+    handle  node,
+    handle* leftmostNode,
+    bool*   heightDecreased)
+  {
+    push(node);
+
+    if (m_links.left(node) == null) {
+      *leftmostNode    = node;
+      *heightDecreased = true;
+      return m_links.right(node);
+    }
+
+    const handle left{
+      detachLeftmostNode(m_links.left(node), leftmostNode, heightDecreased)};
+    m_links.setLeft(node, left);
+
+    if (left != null) {
+      m_links.setParent(left, node);
+    }
+
+    if (*heightDecreased) {
+      return leftSubtreeShrunk(node, heightDecreased);
+    }
+
+    update(node);
+    return node;
+  }
+
+  // Rotations only relink, push and update the nodes, the balance factors
+  // are up to the caller.
+  handle rotateRight(handle node)
+  {
+    const handle left{m_links.left(node)};
+    push(node);
+    push(left);
+    const handle leftRight{m_links.right(left)};
+
+    m_links.setRight(left, node);
+    m_links.setParent(node, left);
+    m_links.setLeft(node, leftRight);
+
+    if (leftRight != null) {
+      m_links.setParent(leftRight, node);
+    }
+
+    update(node);
+    update(left);
+    return left;
+  }
+
+  handle rotateLeft(handle node)
+  {
+    const handle right{m_links.right(node)};
+    push(node);
+    push(right);
+    const handle rightLeft{m_links.left(right)};
+
+    m_links.setLeft(right, node);
+    m_links.setParent(node, right);
+    m_links.setRight(node, rightLeft);
+
+    if (rightLeft != null) {
+      m_links.setParent(rightLeft, node);
+    }
+
+    update(node);
+    update(right);
+    return right;
+  }
+
+  // Restores the AVL property for a node whose balance factor would be 2 or
+  // -2, returns the new root of the subtree.
+  // The balance factor is passed in as the node can't store 2 or -2.
+  handle rebalance(handle node, int balanceFactor)
+  {
+    if (balanceFactor == 2) {
+      const handle left{m_links.left(node)};
+      const int    leftBalance{m_links.balance(left)};
+
+      // Left Left => rotate right
+      // The left child can only be balanced (0) after an erase.
+      if (leftBalance >= 0) {
+        m_links.setBalance(node, 1 - leftBalance);
+        m_links.setBalance(left, leftBalance - 1);
+        return rotateRight(node);
+      }
+
+      // Left Right => rotate left right
+      const handle leftRight{m_links.right(left)};
+      const int    leftRightBalance{m_links.balance(leftRight)};
+      m_links.setBalance(node, leftRightBalance == 1 ? -1 : 0);
+      m_links.setBalance(left, leftRightBalance == -1 ? 1 : 0);
+      m_links.setBalance(leftRight, 0);
+
+      m_links.setLeft(node, rotateLeft(left));
+      m_links.setParent(leftRight, node);
+      return rotateRight(node);
+    }
+
+    const handle right{m_links.right(node)};
+    const int    rightBalance{m_links.balance(right)};
+
+    // Right Right => rotate left
+    // The right child can only be balanced (0) after an erase.
+    if (rightBalance <= 0) {
+      m_links.setBalance(node, -1 - rightBalance);
+      m_links.setBalance(right, rightBalance + 1);
+      return rotateLeft(node);
+    }
+
+    // Right Left => rotate right left
+    const handle rightLeft{m_links.left(right)};
+    const int    rightLeftBalance{m_links.balance(rightLeft)};
+    m_links.setBalance(node, rightLeftBalance == -1 ? 1 : 0);
+    m_links.setBalance(right, rightLeftBalance == 1 ? -1 : 0);
+    m_links.setBalance(rightLeft, 0);
+
+    m_links.setRight(node, rotateRight(right));
+    m_links.setParent(rightLeft, node);
+    return rotateLeft(node);
+  }
+
+  // Retracing after the left subtree of node got one level higher.
+  handle leftSubtreeGrew(handle node, bool* heightIncreased)
+  {
+    const int balanceFactor{m_links.balance(node) + 1};
+
+    if (balanceFactor == 2) {
+      // A rotation after an insertion restores the previous height.
+      *heightIncreased = false;
+      return rebalance(node, balanceFactor);
+    }
+
+    m_links.setBalance(node, balanceFactor);
+    *heightIncreased = balanceFactor == 1;
+    update(node);
+    return node;
+  }
+
+  handle rightSubtreeGrew(handle node, bool* heightIncreased)
+  {
+    const int balanceFactor{m_links.balance(node) - 1};
+
+    if (balanceFactor == -2) {
+      *heightIncreased = false;
+      return rebalance(node, balanceFactor);
+    }
+
+    m_links.setBalance(node, balanceFactor);
+    *heightIncreased = balanceFactor == -1;
+    update(node);
+    return node;
+  }
+
+  // Retracing after the left subtree of node lost one level.
+  handle leftSubtreeShrunk(handle node, bool* heightDecreased)
+  {
+    const int balanceFactor{m_links.balance(node) - 1};
+
+    if (balanceFactor == -2) {
+      // The subtree only lost a level if the rotation left it balanced.
+      const handle root{rebalance(node, balanceFactor)};
+      *heightDecreased = m_links.balance(root) == 0;
+      return root;
+    }
+
+    m_links.setBalance(node, balanceFactor);
+    *heightDecreased = balanceFactor == 0;
+    update(node);
+    return node;
+  }
+
+  handle rightSubtreeShrunk(handle node, bool* heightDecreased)
+  {
+    const int balanceFactor{m_links.balance(node) + 1};
+
+    if (balanceFactor == 2) {
+      const handle root{rebalance(node, balanceFactor)};
+      *heightDecreased = m_links.balance(root) == 0;
+      return root;
+    }
+
+    m_links.setBalance(node, balanceFactor);
+    *heightDecreased = balanceFactor == 0;
+    update(node);
+    return node;
+  }
+
+  Links m_links;
+};
+} // namespace detail
+} // namespace at
@@ -0,0 +1,246 @@
+#pragma once
+#include <cstddef>
+
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "avl_tree.hpp"
+
+namespace at {
+/*!
+ * Closed interval [start, end], ready to be used as the Interval of
+ * AvlIntervalTree, e.g. AvlIntervalTree<Interval<int>, T>.
+ */
+template<typename Point>
+struct Interval {
+  friend bool operator==(const Interval& lhs, const Interval& rhs) = default;
+
+  Point start;
+  Point end;
+};
+
+namespace detail {
+// Orders intervals by start, intervals with the same start by end.
+struct IntervalLess {
+  template<typename Interval>
+  bool operator()(const Interval& lhs, const Interval& rhs) const
+  {
+    if (lhs.start < rhs.start) {
+      return true;
+    }
+
+    return !(rhs.start < lhs.start) && lhs.end < rhs.end;
+  }
+};
+
+// Aggregate policy that keeps the greatest end in every subtree.
+// It has no identity, as the aggregate of an empty range is never asked for.
+template<typename Interval>
+struct GreatestEnd {
+  using value_type
+    = std::remove_cvref_t<decltype(std::declval<Interval>().end)>;
+
+  template<typename Element>
+  static value_type of(const Element& element)
+  {
+    return element.first.end;
+  }
+
+  static value_type combine(const value_type& lhs, const value_type& rhs)
+  {
+    return lhs < rhs ? rhs : lhs;
+  }
+};
+
+template<typename Interval, typename Traits>
+struct IntervalTreeTraits : MultiKeyTraits<Traits> {
+  using Aggregate   = GreatestEnd<Interval>;
+  using RangeUpdate = void;
+};
+} // namespace detail
+
+/*!
+ * Multimap from closed intervals to T that finds the intervals containing a
+ * point or overlapping another interval.
+ * Interval has members start and end, ordered by <, start <= end.
+ * It is an AvlMultimap ordered by start whose nodes keep the greatest end in
+ * their subtree, so a query skips every subtree that ends too early and
+ * everything right of the first start that is too late.
+ * A query visits O(log n) nodes plus O(log n) per interval found.
+ * The mapped values can be changed through modify, like with any tree that
+ * keeps an aggregate.
+ */
+template<
+  typename Interval,
+  typename T,
+  typename Allocator = std::allocator<std::pair<const Interval, T>>,
+  typename Traits    = AvlTreeTraits>
+class AvlIntervalTree {
+public:
+  using tree_type = AvlTree<
+    Interval,
+    T,
+    detail::IntervalLess,
+    Allocator,
+    detail::IntervalTreeTraits<Interval, Traits>>;
+  using this_type       = AvlIntervalTree;
+  using interval_type   = Interval;
+  using point_type      = typename detail::GreatestEnd<Interval>::value_type;
+  using mapped_type     = T;
+  using value_type      = typename tree_type::value_type;
+  using size_type       = typename tree_type::size_type;
+  using allocator_type  = Allocator;
+  using iterator        = typename tree_type::iterator;
+  using const_iterator  = typename tree_type::const_iterator;
+  using node_type       = typename tree_type::node_type;
+  using const_reference = const value_type&;
+
+  AvlIntervalTree() = default;
+
+  explicit AvlIntervalTree(const allocator_type& allocator) : m_tree{allocator}
+  {
+  }
+
+  AvlIntervalTree(
+    std::initializer_list<value_type> initList,
+    const allocator_type&             allocator = allocator_type{})
+    : m_tree{initList, detail::IntervalLess{}, allocator}
+  {
+  }
+
+  size_type size() const
+  {
+    return m_tree.size();
+  }
+
+  [[nodiscard]] bool empty() const
+  {
+    return m_tree.empty();
+  }
+
+  iterator begin()
+  {
+    return m_tree.begin();
+  }
+
+  const_iterator begin() const
+  {
+    return m_tree.begin();
+  }
+
+  iterator end()
+  {
+    return m_tree.end();
+  }
+
+  const_iterator end() const
+  {
+    return m_tree.end();
+  }
+
+  void clear() noexcept
+  {
+    m_tree.clear();
+  }
+
+  /*!
+   * Inserts interval behind the ones that are equal to it.
+   */
+  template<typename Mapped>
+  iterator insert(const interval_type& interval, Mapped&& value)
+  {
+    return m_tree.insert(interval, std::forward<Mapped>(value)).first;
+  }
+
+  /*!
+   * Returns an iterator to one of the elements whose interval equals interval,
+   * or end() if there is none.
+   */
+  iterator find(const interval_type& interval)
+  {
+    return m_tree.find(interval);
+  }
+
+  const_iterator find(const interval_type& interval) const
+  {
+    return m_tree.find(interval);
+  }
+
+  /*!
+   * Erases all elements whose interval equals interval, returns an iterator
+   * to the element that followed them.
+   */
+  iterator erase(const interval_type& interval)
+  {
+    return m_tree.erase(interval);
+  }
+
+  node_type extract(const_iterator pos)
+  {
+    return m_tree.extract(pos);
+  }
+
+  template<typename Change>
+  void modify(const_iterator pos, Change&& change)
+  {
+    m_tree.modify(pos, std::forward<Change>(change));
+  }
+
+  /*!
+   * Calls visit(element) for every element whose interval contains point,
+   * ordered by start.
+   */
+  template<typename Visit>
+  void for_each_containing(const point_type& point, Visit&& visit) const
+  {
+    forEachOverlapping(m_tree.m_root, point, point, visit);
+  }
+
+  /*!
+   * Calls visit(element) for every element whose interval shares at least a
+   * point with interval, ordered by start.
+   */
+  template<typename Visit>
+  void for_each_overlapping(const interval_type& interval, Visit&& visit) const
+  {
+    forEachOverlapping(m_tree.m_root, interval.start, interval.end, visit);
+  }
+
+  const tree_type& tree() const
+  {
+    return m_tree;
+  }
+
+private:
+  using Node = typename tree_type::Node;
+
+  // Intervals overlap [start, end] if they start no later than end and
+  // end no earlier than start.
+  template<typename Visit>
+  static void forEachOverlapping(
+    const Node*       node,
+    const point_type& start,
+    const point_type& end,
+    Visit&            visit)
+  {
+    while (node != nullptr && !(node->aggregate < start)) {
+      forEachOverlapping(node->left(), start, end, visit);
+
+      if (end < node->key().start) {
+        return; // So does everything to the right.
+      }
+
+      if (!(node->key().end < start)) {
+        visit(std::as_const(node->element));
+      }
+
+      node = node->right();
+    }
+  }
+
+  tree_type m_tree;
+};
+} // namespace at
@@ -1,35 +1,172 @@
 #pragma once
-#ifdef DEBUG_MODE
-#define _CRTDBG_MAP_ALLOC
-#include <crtdbg.h>
-#include <cstdlib>
-#define DBG_NEW new (_CLIENT_BLOCK, __FILE__, __LINE__)
-#else
-#define DBG_NEW new
-#endif
-
 #include <cstddef>
+#include <cstdint>
 
 #include <algorithm>
+#include <array>
+#include <concepts>
 #include <functional>
 #include <initializer_list>
 #include <iterator>
 #include <locale>
+#include <memory>
+#include <optional>
 #include <ostream>
+#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
+#include "avl_algorithms.hpp"
+
 namespace at {
-template<typename Key, typename T, typename Compare = std::less<Key>>
+// Defined in tree_reclaimer.hpp, which detach_for_disposal needs.
+class TreeReclaimer;
+
+/*!
+ * Compile time options of AvlTree.
+ * Derive from this type and redeclare members to change them.
+ */
+struct AvlTreeTraits {
+  /*!
+   * Whether nodes link to their parent.
+   * Without parent links every node is one pointer smaller and mutations
+   * don't have to keep the parent links up to date.
+   * Iterators carry the path from the root to their node instead,
+   * which makes them about 750 bytes large and expensive to copy.
+   */
+  static constexpr bool parentLinks{true};
+
+  /*!
+   * Whether keys are unique.
+   * Otherwise insert always inserts (the bool it returns is always true),
+   * behind the elements with an equivalent key, and erase removes all of
+   * them, see AvlMultimap.
+   */
+  static constexpr bool uniqueKeys{true};
+
+  /*!
+   * Whether nodes know the size of their subtree.
+   * Makes every node one size_type larger and lets nth, rank, count_range,
+   * sample and iterator arithmetic (it + n, last - first) take O(log n)
+   * steps instead of O(n).
+   */
+  static constexpr bool orderStatistics{false};
+
+  /*!
+   * Policy for keeping an aggregate of the elements of every subtree in its
+   * root, or void for none. It has
+   *   a member type value_type,
+   *   static value_type identity(),
+   *   static value_type of(const Element& element) and
+   *   static value_type combine(const value_type& lhs, const value_type& rhs),
+   * where combine is associative with identity() as neutral element and
+   * receives the aggregate of the lower keys as lhs. Only the aggregate
+   * functions need identity().
+   * Makes aggregate(low, high) take O(log n) steps. Elements can't be
+   * changed through iterators then, modify keeps the aggregates up to date.
+   */
+  using Aggregate = void;
+
+  /*!
+   * Policy for changing the mapped values of whole key ranges at once with
+   * range_apply, or void for none. It has
+   *   a member type value_type for the changes,
+   *   static void apply(const value_type& change, T& mapped),
+   *   static value_type compose(const value_type& first,
+   *                             const value_type& second),
+   *     which has the effect of first followed by second, and
+   *   static void applyToAggregate(const value_type& change,
+   *                                Aggregate::value_type& aggregate)
+   *     if there is an Aggregate.
+   * Changes to whole subtrees wait in their root until something needs its
+   * children, which makes range_apply take O(log n) steps.
+   * range_apply invalidates all iterators, and as even const member
+   * functions hand pending changes down, the tree can't be read from
+   * several threads at once. Hinted insertions take O(log n) steps.
+   */
+  using RangeUpdate = void;
+};
+
+namespace detail {
+template<typename Traits>
+struct MultiKeyTraits : Traits {
+  static constexpr bool uniqueKeys{false};
+};
+
+template<typename Aggregate>
+struct AggregateValue {
+  using type = typename Aggregate::value_type;
+};
+
+// Not Empty, which the subtree size may be already, as two empty members of
+// the same type can't share their address.
+template<>
+struct AggregateValue<void> {
+  struct type {
+  };
+};
+
+template<typename RangeUpdate>
+struct PendingUpdate {
+  using type = std::optional<typename RangeUpdate::value_type>;
+};
+
+template<>
+struct PendingUpdate<void> {
+  struct type {
+  };
+};
+
+// Comparators that compare keys with other types, like std::less<>.
+template<typename Compare>
+concept Transparent = requires { typename Compare::is_transparent; };
+} // namespace detail
+
+template<typename Interval, typename T, typename Allocator, typename Traits>
+class AvlIntervalTree;
+
+/*!
+ * Tag for functions that take a range whose keys are strictly increasing.
+ */
+struct sorted_unique_t {
+  explicit sorted_unique_t() = default;
+};
+
+inline constexpr sorted_unique_t sorted_unique{};
+
+/*!
+ * Ordered map based on an AVL tree.
+ * With T = void the nodes store nothing but the key and the tree is an
+ * ordered set, see AvlSet.
+ * Whether keys have to be unique is up to the Traits, see AvlMultimap.
+ * Finding, inserting and erasing a key take a single comparison per level
+ * if Compare has a member compare3(lhs, rhs) that returns a value which
+ * compares to 0 like lhs <=> rhs, or if Compare is std::less and the keys
+ * are arithmetic types, pointers or standard strings. Otherwise they take
+ * up to two.
+ */
+template<
+  typename Key,
+  typename T,
+  typename Compare   = std::less<Key>,
+  typename Allocator = std::allocator<std::pair<const Key, T>>,
+  typename Traits    = AvlTreeTraits>
 class AvlTree {
+private:
+  static constexpr bool isSet{std::is_void_v<T>};
+
 public:
   using this_type       = AvlTree;
   using key_type        = Key;
   using mapped_type     = T;
-  using value_type      = std::pair<const key_type, mapped_type>;
+  using value_type      = std::conditional_t<
+    isSet,
+    key_type,
+    std::pair<const key_type, mapped_type>>;
   using size_type       = std::size_t;
   using ssize_type      = std::make_signed_t<size_type>;
   using difference_type = std::ptrdiff_t;
@@ -38,51 +175,158 @@ public:
   using const_reference = const value_type&;
   using pointer         = value_type*;
   using const_pointer   = const value_type*;
+  using allocator_type  = Allocator;
+  using traits_type     = Traits;
 
   class const_iterator;
 
 private:
-  struct Node {
-    Node(const key_type& key, const mapped_type& value)
-      : keyValuePair{key, value}
-      , parent{nullptr}
-      , left{nullptr}
-      , right{nullptr}
-      , height{1}
+  static constexpr bool hasParentLinks{traits_type::parentLinks};
+  static constexpr bool uniqueKeys{traits_type::uniqueKeys};
+  static constexpr bool orderStatistics{traits_type::orderStatistics};
+
+  using Aggregate = typename traits_type::Aggregate;
+
+  static constexpr bool hasAggregate{!std::is_void_v<Aggregate>};
+
+  using RangeUpdate = typename traits_type::RangeUpdate;
+
+  static constexpr bool hasRangeUpdate{!std::is_void_v<RangeUpdate>};
+
+  static_assert(
+    !(isSet && hasRangeUpdate),
+    "AvlTree: range updates change mapped values, which sets don't have.");
+
+  // Elements that are part of an aggregate may only change through modify,
+  // the ones in a subtree with a pending update would show the old value.
+  static constexpr bool readOnlyElements{
+    isSet || hasAggregate || hasRangeUpdate};
+
+  using SubtreeSize = std::
+    conditional_t<orderStatistics, size_type, detail::Empty>;
+  using AggregateValue = typename detail::AggregateValue<Aggregate>::type;
+  using PendingUpdate  = typename detail::PendingUpdate<RangeUpdate>::type;
+
+  struct Node : detail::NodeLinks<Node, hasParentLinks> {
+    template<typename... Args>
+    explicit Node(Args&&... args) : element(std::forward<Args>(args)...)
     {
     }
 
     const key_type& key() const
     {
-      return keyValuePair.first;
+      return keyOf(element);
     }
 
-    mapped_type& value()
+    auto& value()
+      requires(!isSet)
     {
-      return keyValuePair.second;
+      return element.second;
     }
 
-    const mapped_type& value() const
+    const auto& value() const
+      requires(!isSet)
     {
       return const_cast<Node*>(this)->value();
     }
 
-    value_type keyValuePair;
-    Node*      parent;
-    Node*      left;
-    Node*      right;
-    ssize_type height;
+    value_type                           element;
+    [[no_unique_address]] SubtreeSize    subtreeSize{};
+    [[no_unique_address]] AggregateValue aggregate{};
+    [[no_unique_address]] PendingUpdate  pending{};
+  };
+
+  static_assert(alignof(Node) >= 4, "AvlTree: no room for balance factor.");
+
+  // The links are the only overhead, e.g. 32 bytes per node for
+  // AvlTree<int, int> or AvlSet<std::uint64_t> on 64 bit platforms
+  // or 24 bytes without parent links, plus the subtree size if asked for.
+  static constexpr std::size_t nodeLinksSize{
+    (hasParentLinks ? 3 : 2) * sizeof(Node*)};
+  static_assert(
+    alignof(value_type) > alignof(Node*) || orderStatistics || hasAggregate
+      || hasRangeUpdate || sizeof(Node)
+           == (nodeLinksSize + sizeof(value_type) + alignof(Node*) - 1)
+                / alignof(Node*) * alignof(Node*),
+    "AvlTree: unexpected padding in Node.");
+
+  using node_allocator_type = typename std::allocator_traits<
+    allocator_type>::template rebind_alloc<Node>;
+  using node_allocator_traits = std::allocator_traits<node_allocator_type>;
+
+  static_assert(
+    std::is_same_v<typename node_allocator_traits::pointer, Node*>,
+    "AvlTree: allocators with fancy pointers are not supported.");
+
+  struct Links : detail::NodePointerLinks<Node> {
+    void update(Node* node) const
+      requires(orderStatistics || hasAggregate)
+    {
+      if constexpr (orderStatistics) {
+        node->subtreeSize
+          = subtreeSizeOf(node->left()) + subtreeSizeOf(node->right()) + 1;
+      }
+
+      if constexpr (hasAggregate) {
+        AggregateValue aggregate{Aggregate::of(node->element)};
+
+        if (node->left() != nullptr) {
+          aggregate = Aggregate::combine(node->left()->aggregate, aggregate);
+        }
+
+        if (node->right() != nullptr) {
+          aggregate = Aggregate::combine(aggregate, node->right()->aggregate);
+        }
+
+        node->aggregate = std::move(aggregate);
+      }
+    }
+
+    void push(Node* node) const
+      requires hasRangeUpdate
+    {
+      if (!node->pending.has_value()) {
+        return;
+      }
+
+      for (Node* child : {node->left(), node->right()}) {
+        if (child != nullptr) {
+          applyToSubtree(child, *node->pending);
+        }
+      }
+
+      node->pending.reset();
+    }
+  };
+
+  using Algorithms = detail::AvlAlgorithms<Links>;
+
+  // The first and the last node, which tell a hinted insertion at either end
+  // that there is nothing beyond without walking along the edge of the tree.
+  // Only kept with parent links, null while unknown.
+  struct KnownExtremes {
+    Node* first{nullptr};
+    Node* last{nullptr};
   };
 
+  using Extremes = std::
+    conditional_t<hasParentLinks, KnownExtremes, detail::Empty>;
+
 public:
   friend std::ostream& operator<<(std::ostream& os, const const_iterator& it);
 
+  // Walks the nodes, guided by the greatest end of every subtree.
+  template<typename Interval, typename U, typename Alloc, typename Tr>
+  friend class AvlIntervalTree;
+
   class iterator {
   public:
     using difference_type   = typename AvlTree::difference_type;
     using value_type        = std::remove_cv_t<typename AvlTree::value_type>;
-    using pointer           = value_type*;
-    using reference         = value_type&;
+    using pointer           = std::
+      conditional_t<readOnlyElements, const value_type*, value_type*>;
+    using reference         = std::
+      conditional_t<readOnlyElements, const value_type&, value_type&>;
     using iterator_category = std::bidirectional_iterator_tag;
     using iterator_concept  = std::bidirectional_iterator_tag; // C++20
 
@@ -103,18 +347,14 @@ public:
       return os << "AvlTree::iterator{" << it.m_node << '}';
     }
 
-    iterator(Node* root, Node* node) : m_node{node}, m_root{root}
-    {
-    }
-
     reference operator*() const
     {
-      return m_node->keyValuePair;
+      return m_node->element;
     }
 
     pointer operator->() const
     {
-      return &m_node->keyValuePair;
+      return &m_node->element;
     }
 
     iterator& operator++() // prefix increment
@@ -124,7 +364,7 @@ public:
           "AvlTree::iterator: prefix increment called on end iterator!"};
       }
 
-      increment(m_node);
+      increment();
       return *this;
     }
 
@@ -139,17 +379,14 @@ public:
     {
       // Decrement end.
       if (m_node == nullptr) {
-        Node* node{m_root};
-
-        while (node->right != nullptr) {
-          node = node->right;
+        for (Node* node{root()}; node != nullptr; node = node->right()) {
+          descend(node);
         }
 
-        m_node = node;
         return *this;
       }
 
-      decrement(m_node);
+      decrement();
       return *this;
     }
 
@@ -160,51 +397,243 @@ public:
       return it;
     }
 
+    /*!
+     * Moves offset elements ahead in O(log n) steps, or back if it is
+     * negative, which must not leave [begin(), end()].
+     * std::distance and std::advance still take linear time,
+     * as the iterator is bidirectional.
+     */
+    iterator& operator+=(difference_type offset)
+      requires orderStatistics
+    {
+      moveTo(static_cast<size_type>(
+        static_cast<difference_type>(index()) + offset));
+      return *this;
+    }
+
+    iterator& operator-=(difference_type offset)
+      requires orderStatistics
+    {
+      return *this += -offset;
+    }
+
+    friend iterator operator+(iterator it, difference_type offset)
+      requires orderStatistics
+    {
+      return it += offset;
+    }
+
+    friend iterator operator-(iterator it, difference_type offset)
+      requires orderStatistics
+    {
+      return it -= offset;
+    }
+
+    /*!
+     * Returns the number of increments from rhs to lhs in O(log n) steps.
+     */
+    friend difference_type operator-(const iterator& lhs, const iterator& rhs)
+      requires orderStatistics
+    {
+      return static_cast<difference_type>(lhs.index())
+             - static_cast<difference_type>(rhs.index());
+    }
+
   private:
-    static void increment(Node*& node)
+    using Path = std::
+      conditional_t<hasParentLinks, detail::Empty, detail::NodePath<Node>>;
+
+    // Creates an end iterator of tree, use descend to move it to a node.
+    explicit iterator(AvlTree* tree) : m_node{nullptr}, m_tree{tree}, m_path{}
+    {
+    }
+
+    // Moves to node, which must be the root or a child of the current node.
+    void descend(Node* node)
+    {
+      if (m_node != nullptr) {
+        algorithms().push(m_node);
+      }
+
+      if constexpr (!hasParentLinks) {
+        m_path.push(node);
+      }
+
+      m_node = node;
+    }
+
+    // Moves back up to ancestor, which must be on the path to the current
+    // node, or to the end if it is nullptr.
+    void ascendTo(Node* ancestor)
+    {
+      if constexpr (!hasParentLinks) {
+        while (!m_path.empty() && m_path.top() != ancestor) {
+          m_path.pop();
+        }
+      }
+
+      m_node = ancestor;
+    }
+
+    // The current root of the tree, which rotations may have moved since the
+    // iterator was created. Parent links tell it even if the elements moved
+    // to another tree since.
+    Node* root() const
+    {
+      if constexpr (hasParentLinks) {
+        if (m_node != nullptr) {
+          Node* node{m_node};
+
+          while (node->parent() != nullptr) {
+            node = node->parent();
+          }
+
+          return node;
+        }
+      }
+
+      return m_tree->m_root;
+    }
+
+    // Returns the number of elements before the current one, or the size
+    // of the tree at the end.
+    size_type index() const
     {
-      if (node->right != nullptr) {
-        node = node->right;
+      if (m_node == nullptr) {
+        return subtreeSizeOf(root());
+      }
+
+      size_type index{subtreeSizeOf(m_node->left())};
+      Node*     node{m_node};
+
+      if constexpr (hasParentLinks) {
+        for (Node* parent{node->parent()}; parent != nullptr;
+             parent = node->parent()) {
+          if (node == parent->right()) {
+            index += subtreeSizeOf(parent->left()) + 1;
+          }
 
-        while (node->left != nullptr) {
-          node = node->left;
+          node = parent;
         }
       }
       else {
-        Node* parent{node->parent};
+        detail::NodePath<Node> path{m_path};
 
-        while (parent != nullptr && node == parent->right) {
-          node   = parent;
-          parent = node->parent;
+        for (path.pop(); !path.empty(); path.pop()) {
+          if (node == path.top()->right()) {
+            index += subtreeSizeOf(path.top()->left()) + 1;
+          }
+
+          node = path.top();
         }
+      }
+
+      return index;
+    }
+
+    // Moves to the element at index, or to the end if there is none.
+    void moveTo(size_type index)
+    {
+      Node* node{root()};
+      m_node = nullptr;
+      m_path = Path{};
+
+      if (index >= subtreeSizeOf(node)) {
+        return;
+      }
+
+      for (;;) {
+        descend(node);
+        const size_type leftSize{subtreeSizeOf(node->left())};
 
-        node = parent;
+        if (index < leftSize) {
+          node = node->left();
+        }
+        else if (index > leftSize) {
+          index -= leftSize + 1;
+          node = node->right();
+        }
+        else {
+          return;
+        }
       }
     }
 
-    static void decrement(Node*& node)
+    void increment()
     {
-      if (node->left != nullptr) {
-        node = node->left;
+      if (m_node->right() != nullptr) {
+        descend(m_node->right());
+
+        while (m_node->left() != nullptr) {
+          descend(m_node->left());
+        }
+
+        return;
+      }
+
+      if constexpr (hasParentLinks) {
+        Node* node{m_node};
+        Node* parent{node->parent()};
 
-        while (node->right != nullptr) {
-          node = node->right;
+        while (parent != nullptr && node == parent->right()) {
+          node   = parent;
+          parent = node->parent();
         }
+
+        m_node = parent;
       }
       else {
-        Node* parent{node->parent};
+        Node* node{m_node};
+        m_path.pop();
+
+        while (!m_path.empty() && node == m_path.top()->right()) {
+          node = m_path.top();
+          m_path.pop();
+        }
+
+        m_node = m_path.empty() ? nullptr : m_path.top();
+      }
+    }
+
+    void decrement()
+    {
+      if (m_node->left() != nullptr) {
+        descend(m_node->left());
+
+        while (m_node->right() != nullptr) {
+          descend(m_node->right());
+        }
+
+        return;
+      }
+
+      if constexpr (hasParentLinks) {
+        Node* node{m_node};
+        Node* parent{node->parent()};
 
-        while (parent != nullptr && node == parent->left) {
+        while (parent != nullptr && node == parent->left()) {
           node   = parent;
-          parent = node->parent;
+          parent = node->parent();
         }
 
-        node = parent;
+        m_node = parent;
+      }
+      else {
+        Node* node{m_node};
+        m_path.pop();
+
+        while (!m_path.empty() && node == m_path.top()->left()) {
+          node = m_path.top();
+          m_path.pop();
+        }
+
+        m_node = m_path.empty() ? nullptr : m_path.top();
       }
     }
 
-    Node* m_node;
-    Node* m_root;
+    Node*                      m_node;
+    AvlTree*                   m_tree;
+    [[no_unique_address]] Path m_path;
   };
 
   class const_iterator {
@@ -216,6 +645,8 @@ public:
     using iterator_category = std::bidirectional_iterator_tag;
     using iterator_concept  = std::bidirectional_iterator_tag; // C++20
 
+    friend class AvlTree;
+
     friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
     {
       return lhs.m_it == rhs.m_it;
@@ -272,6 +703,40 @@ public:
       return it;
     }
 
+    const_iterator& operator+=(difference_type offset)
+      requires orderStatistics
+    {
+      m_it += offset;
+      return *this;
+    }
+
+    const_iterator& operator-=(difference_type offset)
+      requires orderStatistics
+    {
+      m_it -= offset;
+      return *this;
+    }
+
+    friend const_iterator operator+(const_iterator it, difference_type offset)
+      requires orderStatistics
+    {
+      return it += offset;
+    }
+
+    friend const_iterator operator-(const_iterator it, difference_type offset)
+      requires orderStatistics
+    {
+      return it -= offset;
+    }
+
+    friend difference_type operator-(
+      const const_iterator& lhs,
+      const const_iterator& rhs)
+      requires orderStatistics
+    {
+      return lhs.m_it - rhs.m_it;
+    }
+
   private:
     iterator m_it;
   };
@@ -279,14 +744,152 @@ public:
   using reverse_iterator       = std::reverse_iterator<iterator>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
-#define AT_CMPKEY(key1, key2) key_compare{}((key1), (key2))
+  /*!
+   * Owns a node that was extracted from an AvlTree, along with a copy of
+   * the allocator that can destroy it.
+   * Lets elements move between trees with equal allocators and lets their
+   * keys change without allocating a new node.
+   */
+  class node_type {
+  public:
+    using key_type       = typename AvlTree::key_type;
+    using mapped_type    = typename AvlTree::mapped_type;
+    using allocator_type = typename AvlTree::allocator_type;
+
+    friend class AvlTree;
+
+    node_type() : m_node{nullptr}, m_nodeAllocator{}
+    {
+    }
+
+    node_type(node_type&& other) noexcept
+      : m_node{other.m_node}, m_nodeAllocator{std::move(other.m_nodeAllocator)}
+    {
+      other.m_node = nullptr;
+      other.m_nodeAllocator.reset();
+    }
+
+    node_type& operator=(node_type&& other) noexcept
+    {
+      if (this == &other) {
+        return *this;
+      }
+
+      reset();
+      m_node          = other.m_node;
+      m_nodeAllocator = std::move(other.m_nodeAllocator);
+      other.m_node    = nullptr;
+      other.m_nodeAllocator.reset();
+      return *this;
+    }
+
+    ~node_type()
+    {
+      reset();
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+      return m_node == nullptr;
+    }
+
+    explicit operator bool() const
+    {
+      return !empty();
+    }
+
+    /*!
+     * The key may be changed while the node is not part of a tree.
+     */
+    key_type& key() const
+    {
+      return const_cast<key_type&>(m_node->key());
+    }
+
+    auto& mapped() const
+      requires(!isSet)
+    {
+      return m_node->value();
+    }
+
+    /*!
+     * The element of a set, which is its key.
+     */
+    key_type& value() const
+      requires isSet
+    {
+      return key();
+    }
+
+    allocator_type get_allocator() const
+    {
+      return allocator_type{*m_nodeAllocator};
+    }
+
+    void swap(node_type& other) noexcept
+    {
+      using std::swap;
+      swap(m_node, other.m_node);
+      swap(m_nodeAllocator, other.m_nodeAllocator);
+    }
+
+    friend void swap(node_type& lhs, node_type& rhs) noexcept
+    {
+      lhs.swap(rhs);
+    }
+
+  private:
+    node_type(Node* node, const node_allocator_type& nodeAllocator)
+      : m_node{node}, m_nodeAllocator{nodeAllocator}
+    {
+    }
+
+    void reset() noexcept
+    {
+      if (m_node != nullptr) {
+        node_allocator_traits::destroy(*m_nodeAllocator, m_node);
+        node_allocator_traits::deallocate(*m_nodeAllocator, m_node, 1);
+        m_node = nullptr;
+      }
+
+      m_nodeAllocator.reset();
+    }
+
+    Node* release() noexcept
+    {
+      Node* node{m_node};
+      m_node = nullptr;
+      m_nodeAllocator.reset();
+      return node;
+    }
+
+    Node*                              m_node;
+    std::optional<node_allocator_type> m_nodeAllocator;
+  };
+
+  struct insert_return_type {
+    iterator  position;
+    bool      inserted;
+    node_type node;
+  };
+
+#define AT_CMPKEY(key1, key2) m_compare((key1), (key2))
 
   class value_compare {
   public:
     bool operator()(const_reference lhs, const_reference rhs) const
     {
-      return AT_CMPKEY(lhs.first, rhs.first);
+      return AT_CMPKEY(keyOf(lhs), keyOf(rhs));
+    }
+
+  private:
+    friend class AvlTree;
+
+    explicit value_compare(const key_compare& compare) : m_compare{compare}
+    {
     }
+
+    [[no_unique_address]] key_compare m_compare;
   };
 
   friend std::ostream& operator<<(std::ostream& os, const this_type& tree)
@@ -297,7 +900,14 @@ public:
 
     std::ostringstream outputStringStream{};
     outputStringStream.imbue(std::locale::classic());
-    printTree(tree.m_root, 0, outputStringStream);
+    algorithms().printTree(
+      tree.m_root, 0, outputStringStream, [](std::ostream& os, Node* node) {
+        os << node->key();
+
+        if constexpr (!isSet) {
+          os << " => " << node->value();
+        }
+      });
     std::string string{outputStringStream.str()};
 
     for (int i{0}; i < 5; ++i) {
@@ -308,74 +918,239 @@ public:
     return os;
   }
 
-  AvlTree() : m_root{nullptr}, m_nodeCount{0}
+  AvlTree() : AvlTree{key_compare{}}
   {
   }
 
-  template<typename InputIterator>
-  AvlTree(InputIterator first, InputIterator last) : AvlTree{}
+  explicit AvlTree(
+    const key_compare&    compare,
+    const allocator_type& allocator = allocator_type{})
+    : m_root{nullptr}
+    , m_nodeCount{0}
+    , m_compare{compare}
+    , m_nodeAllocator{allocator}
   {
-    while (first != last) {
-      insert(*first);
-      ++first;
-    }
   }
 
-  AvlTree(std::initializer_list<value_type> initList)
-    : AvlTree{initList.begin(), initList.end()}
+  explicit AvlTree(const allocator_type& allocator)
+    : AvlTree{key_compare{}, allocator}
   {
   }
 
-  AvlTree(const this_type& other) : AvlTree{}
+  template<std::input_iterator InputIterator>
+  AvlTree(
+    InputIterator         first,
+    InputIterator         last,
+    const key_compare&    compare   = key_compare{},
+    const allocator_type& allocator = allocator_type{})
+    : AvlTree{compare, allocator}
   {
-    copy(other);
+    insert(first, last);
   }
 
-  this_type& operator=(const this_type& other)
+  template<std::input_iterator InputIterator>
+  AvlTree(
+    InputIterator         first,
+    InputIterator         last,
+    const allocator_type& allocator)
+    : AvlTree{first, last, key_compare{}, allocator}
   {
-    if (this == &other) {
-      return *this;
-    }
-
-    clear();
-    copy(other);
-    return *this;
   }
 
-  this_type& operator=(std::initializer_list<value_type> initList)
+  /*!
+   * Builds the tree from a range sorted by strictly increasing keys
+   * in linear time.
+   */
+  template<std::forward_iterator ForwardIterator>
+  AvlTree(
+    sorted_unique_t,
+    ForwardIterator       first,
+    ForwardIterator       last,
+    const key_compare&    compare   = key_compare{},
+    const allocator_type& allocator = allocator_type{})
+    : AvlTree{compare, allocator}
   {
-    clear();
-
-    for (const value_type& keyValuePair : initList) {
-      insert(keyValuePair);
-    }
+    insert(sorted_unique, first, last);
+  }
 
-    return *this;
+  template<std::forward_iterator ForwardIterator>
+  AvlTree(
+    sorted_unique_t,
+    ForwardIterator       first,
+    ForwardIterator       last,
+    const allocator_type& allocator)
+    : AvlTree{sorted_unique, first, last, key_compare{}, allocator}
+  {
   }
 
-  ~AvlTree()
+  AvlTree(
+    std::initializer_list<value_type> initList,
+    const key_compare&                compare   = key_compare{},
+    const allocator_type&             allocator = allocator_type{})
+    : AvlTree{initList.begin(), initList.end(), compare, allocator}
   {
-    destroyTree(m_root);
   }
 
-  size_type size() const
+  AvlTree(
+    std::initializer_list<value_type> initList,
+    const allocator_type&             allocator)
+    : AvlTree{initList, key_compare{}, allocator}
   {
-    return m_nodeCount;
   }
 
-  [[nodiscard]] bool empty() const
+  AvlTree(const this_type& other)
+    : AvlTree{other, copyConstructionAllocator(other)}
   {
-    return size() == 0;
   }
 
-  iterator begin()
+  AvlTree(const this_type& other, const allocator_type& allocator)
+    : AvlTree{other.m_compare, allocator}
   {
-    if (empty()) {
-      return end();
+    copy(other);
+  }
+
+  AvlTree(this_type&& other) noexcept
+    : m_root{other.m_root}
+    , m_nodeCount{other.m_nodeCount}
+    , m_compare{std::move(other.m_compare)}
+    , m_nodeAllocator{std::move(other.m_nodeAllocator)}
+  {
+    other.m_root      = nullptr;
+    other.m_nodeCount = 0;
+    other.forgetExtremes();
+  }
+
+  this_type& operator=(const this_type& other)
+  {
+    if (this == &other) {
+      return *this;
+    }
+
+    clear();
+    m_compare = other.m_compare;
+
+    if constexpr (node_allocator_traits::
+                    propagate_on_container_copy_assignment::value) {
+      m_nodeAllocator = other.m_nodeAllocator;
+    }
+
+    copy(other);
+    return *this;
+  }
+
+  this_type& operator=(this_type&& other) noexcept(
+    node_allocator_traits::propagate_on_container_move_assignment::value
+    || node_allocator_traits::is_always_equal::value)
+  {
+    if (this == &other) {
+      return *this;
+    }
+
+    clear();
+    m_compare = std::move(other.m_compare);
+
+    if constexpr (node_allocator_traits::
+                    propagate_on_container_move_assignment::value) {
+      m_nodeAllocator = std::move(other.m_nodeAllocator);
+    }
+    else if (m_nodeAllocator != other.m_nodeAllocator) {
+      // The nodes can't change hands, move the elements over one by one.
+      for (auto& element : other) {
+        emplace(std::move(element));
+      }
+
+      other.clear();
+      return *this;
+    }
+
+    m_root            = other.m_root;
+    m_nodeCount       = other.m_nodeCount;
+    other.m_root      = nullptr;
+    other.m_nodeCount = 0;
+    other.forgetExtremes();
+    return *this;
+  }
+
+  this_type& operator=(std::initializer_list<value_type> initList)
+  {
+    clear();
+
+    for (const value_type& element : initList) {
+      insert(element);
+    }
+
+    return *this;
+  }
+
+  ~AvlTree()
+  {
+    clear();
+  }
+
+  allocator_type get_allocator() const
+  {
+    return allocator_type{m_nodeAllocator};
+  }
+
+  key_compare key_comp() const
+  {
+    return m_compare;
+  }
+
+  value_compare value_comp() const
+  {
+    return value_compare{m_compare};
+  }
+
+  size_type size() const
+  {
+    return m_nodeCount;
+  }
+
+  [[nodiscard]] bool empty() const
+  {
+    return size() == 0;
+  }
+
+  /*!
+   * Lets the allocator prepare storage for count nodes in total,
+   * if it supports that (like at::PoolAllocator does).
+   * Does nothing otherwise.
+   */
+  void reserve(size_type count)
+  {
+    if constexpr (requires(node_allocator_type & allocator) {
+                    allocator.reserve(count);
+                  }) {
+      if (count > size()) {
+        m_nodeAllocator.reserve(count - size());
+      }
+    }
+  }
+
+  /*!
+   * Lets the allocator return storage that is not in use,
+   * if it supports that (like at::PoolAllocator does).
+   * Does nothing otherwise.
+   */
+  void shrink_to_fit()
+  {
+    if constexpr (requires(node_allocator_type & allocator) {
+                    allocator.shrink_to_fit();
+                  }) {
+      m_nodeAllocator.shrink_to_fit();
+    }
+  }
+
+  iterator begin()
+  {
+    iterator it{end()};
+
+    for (Node* node{m_root}; node != nullptr; node = node->left()) {
+      it.descend(node);
     }
 
-    Node** smallest{leftmostNode(&m_root)};
-    return iterator{m_root, *smallest};
+    return it;
   }
 
   const_iterator begin() const
@@ -390,7 +1165,7 @@ public:
 
   iterator end()
   {
-    return iterator{m_root, nullptr};
+    return iterator{this};
   }
 
   const_iterator end() const
@@ -435,461 +1210,1833 @@ public:
 
   void clear()
   {
-    destroyTree(m_root);
+    if (!releaseAllNodes(m_nodeAllocator)) {
+      destroyTree(m_root);
+    }
+
     m_root      = nullptr;
     m_nodeCount = 0;
+    forgetExtremes();
   }
 
-  std::pair<iterator, bool> insert(
-    const key_type&    key,
-    const mapped_type& value)
+  /*!
+   * Empties the tree in constant time and leaves destroying the elements
+   * to the background thread of reclaimer.
+   * The nodes are destroyed through the current allocator, the tree goes on
+   * with the allocator's select_on_container_copy_construction.
+   * Both have to be usable from different threads at the same time,
+   * which holds for std::allocator and for at::PoolAllocator, which
+   * hands out a fresh pool.
+   * A pool that is still shared with someone else, e.g. a tree split off
+   * from this one or a node handle, would be used by both threads, so the
+   * elements are destroyed right away instead.
+   * Requires including tree_reclaimer.hpp, which starts a thread and
+   * therefore needs the threads library.
+   */
+  template<typename Reclaimer = TreeReclaimer>
+  void detach_for_disposal()
   {
-    bool           didInsert{false};
-    Node*          nodeInserted{nullptr};
-    constexpr bool dontReplace{false};
-    m_root
-      = insertImpl(key, value, m_root, &nodeInserted, &didInsert, dontReplace);
+    detach_for_disposal(Reclaimer::global());
+  }
 
-    if (m_root != nullptr) {
-      m_root->parent = nullptr;
+  template<typename Reclaimer>
+  void detach_for_disposal(Reclaimer& reclaimer)
+  {
+    if (empty()) {
+      return;
     }
 
-    if (didInsert) {
-      ++m_nodeCount;
+    if (isShared(m_nodeAllocator)) {
+      clear();
+      return;
     }
 
-    return {iterator{m_root, nodeInserted}, didInsert};
+    node_allocator_type nextNodeAllocator{
+      node_allocator_traits::select_on_container_copy_construction(
+        m_nodeAllocator)};
+    reclaimer.post([nodeAllocator = m_nodeAllocator,
+                    node = m_root](std::size_t budget) mutable {
+      if (releaseAllNodes(nodeAllocator)) {
+        return true;
+      }
+
+      node = destroyTree(nodeAllocator, node, budget);
+      return node == nullptr;
+    });
+
+    m_nodeAllocator = std::move(nextNodeAllocator);
+    m_root          = nullptr;
+    m_nodeCount     = 0;
+    forgetExtremes();
   }
 
-  std::pair<iterator, bool> insert(const_reference keyValuePair)
+  template<typename KeyType, typename Mapped>
+    requires std::is_constructible_v<key_type, KeyType&&>
+             && std::is_constructible_v<mapped_type, Mapped&&>
+  std::pair<iterator, bool> insert(KeyType&& key, Mapped&& value)
   {
-    return insert(keyValuePair.first, keyValuePair.second);
+    if constexpr (uniqueKeys) {
+      return try_emplace(
+        std::forward<KeyType>(key), std::forward<Mapped>(value));
+    }
+    else {
+      return emplace(std::forward<KeyType>(key), std::forward<Mapped>(value));
+    }
   }
 
-  template<typename InputIterator>
-  void insert(InputIterator first, InputIterator last)
+  std::pair<iterator, bool> insert(const_reference element)
   {
-    while (first != last) {
-      insert(*first);
-      ++first;
+    if constexpr (isSet || !uniqueKeys) {
+      return insertNode(keyOf(element), [&] { return createNode(element); });
+    }
+    else {
+      return try_emplace(element.first, element.second);
     }
   }
 
-  void insert(std::initializer_list<value_type> initList)
+  std::pair<iterator, bool> insert(value_type&& element)
   {
-    insert(initList.begin(), initList.end());
+    return insertNode(
+      keyOf(element), [&] { return createNode(std::move(element)); });
   }
 
-  std::pair<iterator, bool> insert_or_assign(
-    const key_type&    key,
-    const mapped_type& value)
+  /*!
+   * If the key of element is a key_type, e.g. for std::make_pair(key, value),
+   * the node is only created if the key is to be inserted.
+   * Otherwise the same as emplace(element).
+   */
+  template<typename Element>
+    requires std::is_constructible_v<value_type, Element&&>
+  std::pair<iterator, bool> insert(Element&& element)
   {
-    bool           didInsert{false};
-    Node*          nodeInserted{nullptr};
-    constexpr bool doReplace{true};
-    m_root
-      = insertImpl(key, value, m_root, &nodeInserted, &didInsert, doReplace);
-
-    if (m_root != nullptr) {
-      m_root->parent = nullptr;
+    if constexpr (hasKeyOfType<Element>) {
+      return insertNode(keyOf(element), [&] {
+        return createNode(std::forward<Element>(element));
+      });
     }
-
-    if (didInsert) {
-      ++m_nodeCount;
+    else {
+      return emplace(std::forward<Element>(element));
     }
-
-    return {iterator{m_root, nodeInserted}, didInsert};
   }
 
-  std::pair<iterator, bool> insert_or_assign(const value_type& keyValuePair)
+  /*!
+   * If the tree is empty and the keys of the range are sorted,
+   * the tree is built in linear time.
+   * Checking whether the keys are sorted takes another pass over the range.
+   */
+  template<std::input_iterator InputIterator>
+  void insert(InputIterator first, InputIterator last)
   {
-    return insert_or_assign(keyValuePair.first, keyValuePair.second);
-  }
+    if constexpr (
+      std::forward_iterator<InputIterator>
+      && requires(InputIterator it, const key_compare& compare) {
+           compare(keyOf(*it), keyOf(*it));
+         }) {
+      size_type distinctCount{0};
+
+      if (empty() && isSorted(first, last, &distinctCount)) {
+        if constexpr (uniqueKeys) {
+          // Equivalent keys are adjacent, only the first one is inserted.
+          const auto advance{[this, last](InputIterator& it) {
+            const InputIterator previous{it};
+
+            do {
+              ++it;
+            } while (it != last && !AT_CMPKEY(keyOf(*previous), keyOf(*it)));
+          }};
+          buildTree(first, advance, distinctCount);
+        }
+        else {
+          // Equivalent keys stay in the order of the range.
+          const auto advance{[](InputIterator& it) { ++it; }};
+          buildTree(
+            first,
+            advance,
+            static_cast<size_type>(std::distance(first, last)));
+        }
 
-  iterator erase(const key_type& key)
-  {
-    if (empty()) {
-      return end();
+        return;
+      }
     }
 
-    iterator next{end()};
-    m_root = eraseImpl(key, m_root, &next);
+    while (first != last) {
+      insert(*first);
+      ++first;
+    }
+  }
 
-    if (m_root != nullptr) {
-      m_root->parent = nullptr;
+  /*!
+   * Inserts a range sorted by strictly increasing keys,
+   * in linear time if the tree is empty.
+   */
+  template<std::forward_iterator ForwardIterator>
+  void insert(sorted_unique_t, ForwardIterator first, ForwardIterator last)
+  {
+    if (empty()) {
+      const auto advance{[](ForwardIterator& it) { ++it; }};
+      buildTree(
+        first,
+        advance,
+        static_cast<size_type>(std::distance(first, last)));
+      return;
     }
 
-    next.m_root = m_root;
-    return next;
+    insert(first, last);
   }
 
-  void swap(this_type& other) noexcept
+  void insert(std::initializer_list<value_type> initList)
   {
-    std::swap(m_root, other.m_root);
-    std::swap(m_nodeCount, other.m_nodeCount);
+    insert(initList.begin(), initList.end());
   }
 
-  iterator find(const key_type& key)
+  template<typename Mapped>
+    requires(!isSet && uniqueKeys)
+  std::pair<iterator, bool> insert_or_assign(
+    const key_type& key,
+    Mapped&&        value)
   {
-    Node* node{m_root};
-
-    while (node != nullptr) {
-      if (AT_CMPKEY(key, node->key())) { // If key < node.key -> go left.
-        node = node->left;
-      }
-      else if (AT_CMPKEY(node->key(), key)) { // If key > node.key -> go right.
-        node = node->right;
-      }
-      else { // Found it.
-        return iterator{m_root, node};
-      }
-    }
+    return insertOrAssign(key, std::forward<Mapped>(value));
+  }
 
-    return end();
+  template<typename Mapped>
+    requires(!isSet && uniqueKeys)
+  std::pair<iterator, bool> insert_or_assign(key_type&& key, Mapped&& value)
+  {
+    return insertOrAssign(std::move(key), std::forward<Mapped>(value));
   }
 
-  const_iterator find(const key_type& key) const
+  std::pair<iterator, bool> insert_or_assign(const value_type& keyValuePair)
+    requires(!isSet && uniqueKeys)
   {
-    return const_cast<this_type*>(this)->find(key);
+    return insert_or_assign(keyValuePair.first, keyValuePair.second);
   }
 
-private:
-  static void printTree(Node* node, int depth, std::ostream& os)
+  /*!
+   * Constructs the element from args in a new node.
+   * As the key is only known after constructing the element the node is
+   * always created, it is destroyed again if the key is already present.
+   */
+  template<typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args)
   {
-    if (node == nullptr) {
-      return;
-    }
+    Node* const created{createNode(std::forward<Args>(args)...)};
 
-    printTree(node->left, depth + 6, os);
+    try {
+      std::pair<iterator, bool> result{
+        insertNode(created->key(), [created] { return created; })};
 
-    for (int i{0}; i < depth; ++i) {
-      if (i == 0) {
-        os << '|';
+      if (!result.second) {
+        destroyNode(created);
       }
-      else {
-        os << '=';
-      }
-    }
-
-    os << node->key() << " => " << node->value();
-    os << "\n|\n|\n";
 
-    printTree(node->right, depth + 6, os);
+      return result;
+    }
+    catch (...) {
+      destroyNode(created);
+      throw;
+    }
   }
 
-  void copy(const this_type& other)
+  /*!
+   * Inserts element as close as possible to just before hint.
+   * If that's where it belongs, it takes at most two comparisons, e.g. for
+   * appending keys in order with end() or the iterator returned by the
+   * previous insertion as hint. With parent links and neither order
+   * statistics, aggregates nor range updates it also takes an amortized
+   * constant number of steps, otherwise O(log n) steps.
+   * Otherwise it's the same as insert(element).
+   */
+  iterator insert(const_iterator hint, const value_type& element)
   {
-    copy_impl(other.m_root);
+    return insertNodeNear(hint, keyOf(element), [&] {
+      return createNode(element);
+    });
   }
 
-  void copy_impl(Node* other)
+  iterator insert(const_iterator hint, value_type&& element)
   {
-    if (other == nullptr) {
-      return;
-    }
-
-    insert(other->keyValuePair);
-
-    copy_impl(other->left);
-    copy_impl(other->right);
+    return insertNodeNear(hint, keyOf(element), [&] {
+      return createNode(std::move(element));
+    });
   }
 
-  void destroyTree(Node* node)
+  template<typename... Args>
+  iterator emplace_hint(const_iterator hint, Args&&... args)
   {
-    if (node == nullptr) {
-      return;
-    }
+    Node* const created{createNode(std::forward<Args>(args)...)};
+    bool        inserted{false};
 
-    destroyTree(node->right);
-    destroyTree(node->left);
+    try {
+      const iterator it{insertNodeNear(hint, created->key(), [&] {
+        inserted = true;
+        return created;
+      })};
 
-    delete node;
-  }
+      if (!inserted) {
+        destroyNode(created);
+      }
 
-  static ssize_type heightOf(Node* node)
-  {
-    if (node == nullptr) {
-      return 0;
+      return it;
+    }
+    catch (...) {
+      destroyNode(created);
+      throw;
     }
-
-    return node->height;
   }
 
-  ssize_type calculateBalanceFactor(Node* node)
+  /*!
+   * Calls change with a reference to the mapped value of the element at pos
+   * and brings the aggregates above it up to date in O(log n) steps.
+   */
+  template<typename Change>
+    requires(!isSet)
+  void modify(const_iterator pos, Change&& change)
   {
-    if (node == nullptr) {
-      return 0;
-    }
-
-    const ssize_type rightHeight{heightOf(node->right)};
-    const ssize_type leftHeigth{heightOf(node->left)};
-
-    return leftHeigth - rightHeight;
+    std::forward<Change>(change)(pos.m_it.m_node->value());
+    updateUpFrom(pos.m_it);
   }
 
-  Node* rotateRight(Node* node)
+  /*!
+   * Constructs the mapped value from args in place if key is not present.
+   * Otherwise nothing happens, args are not moved from in that case.
+   */
+  template<typename... Args>
+    requires(!isSet && uniqueKeys)
+  std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args)
   {
-    if (node == nullptr) {
-      return nullptr;
-    }
+    return insertNode(key, [&] {
+      return createNode(
+        std::piecewise_construct,
+        std::forward_as_tuple(key),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+  }
 
-    Node* left{node->left};
-    Node* leftRight{left->right};
-    left->right = node;
+  template<typename... Args>
+    requires(!isSet && uniqueKeys)
+  std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args)
+  {
+    return insertNode(key, [&] {
+      return createNode(
+        std::piecewise_construct,
+        std::forward_as_tuple(std::move(key)),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+  }
 
-    if (left->right != nullptr) {
-      left->right->parent = left;
+  /*!
+   * Links the node owned by node into the tree unless its key is already
+   * present, no allocation takes place.
+   * If the node is not inserted it is handed back in the result.
+   * Throws std::invalid_argument if node uses an allocator that can't
+   * deallocate the nodes of this tree.
+   */
+  insert_return_type insert(node_type&& node)
+  {
+    if (node.empty()) {
+      return {end(), false, node_type{}};
     }
 
-    node->left = leftRight;
-
-    if (node->left != nullptr) {
-      node->left->parent = node;
+    if (*node.m_nodeAllocator != m_nodeAllocator) {
+      throw std::invalid_argument{
+        "AvlTree::insert: node handle with an unequal allocator!"};
     }
 
-    node->height = std::max(heightOf(node->right), heightOf(node->left)) + 1;
-    left->height = std::max(heightOf(left->right), heightOf(left->left)) + 1;
+    std::pair<iterator, bool> result{insertNode(node.key(), [&node] {
+      Node* released{node.release()};
+      released->setLeft(nullptr);
+      released->setRight(nullptr);
+      released->setBalance(0);
+      return released;
+    })};
 
-    return left;
+    return {result.first, result.second, std::move(node)};
   }
 
-  Node* rotateLeft(Node* node)
+  /*!
+   * Unlinks the element with a key equivalent to key without destroying it.
+   * Returns an empty node handle if there is no such element.
+   */
+  node_type extract(const key_type& key)
   {
-    if (node == nullptr) {
-      return nullptr;
-    }
-
-    Node* right{node->right};
-    Node* rightLeft{right->left};
+    if constexpr (!uniqueKeys) {
+      // Extracts the first one of the equivalent keys.
+      const iterator it{lowerBound(key)};
 
-    right->left = node;
+      if (it == end() || AT_CMPKEY(key, keyOf(*it))) {
+        return node_type{};
+      }
 
-    if (right->left != nullptr) {
-      right->left->parent = right;
+      return extract(const_iterator{it});
     }
 
-    node->right = rightLeft;
+    Node* extracted{nullptr};
+    Node* next{nullptr};
+    m_root = algorithms().detach(m_root, key, m_compare, &extracted, &next);
 
-    if (node->right != nullptr) {
-      node->right->parent = node;
+    if (extracted == nullptr) {
+      return node_type{};
     }
 
-    node->height  = std::max(heightOf(node->right), heightOf(node->left)) + 1;
-    right->height = std::max(heightOf(right->right), heightOf(right->left)) + 1;
-
-    return right;
+    --m_nodeCount;
+    forgetExtremes();
+    return node_type{extracted, m_nodeAllocator};
   }
 
-  Node** leftmostNode(Node** node)
+  node_type extract(const_iterator pos)
   {
-    Node** result{node};
+    if constexpr (uniqueKeys) {
+      return extract(keyOf(*pos));
+    }
+    else {
+      // Equivalent keys don't tell where pos is, the path down to it does.
+      Node* const            target{pos.m_it.m_node};
+      detail::NodePath<Node> path{pathUpFrom(pos.m_it)};
+      auto                   locate{[&path, target](Node* node) {
+        path.pop();
+
+        if (node == target) {
+          return 0;
+        }
 
-    while ((*result)->left != nullptr) {
-      result = &(*result)->left;
+        return path.top() == node->left() ? -1 : 1;
+      }};
+      Node* extracted{nullptr};
+      Node* next{nullptr};
+      m_root = algorithms().detachAt(m_root, locate, &extracted, &next);
+      --m_nodeCount;
+      forgetExtremes();
+      return node_type{extracted, m_nodeAllocator};
     }
-
-    return result;
   }
 
-  Node* detachLeftmostNode(Node*& node)
+  iterator erase(const key_type& key)
   {
-    Node** leftmost{leftmostNode(&node)};
-    return detachNode(*leftmost);
+    return eraseImpl(key);
   }
 
-  Node* detachNode(Node*& node)
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  iterator erase(const K& key)
   {
-    if (node->left == nullptr && node->right == nullptr) {
-      // No children.
-      Node* detached{node};
-      node = nullptr;
-      return detached;
-    }
-
-    if (node->left != nullptr && node->right != nullptr) {
-      // Two children.
-      Node* replacement{detachLeftmostNode(node->right)};
+    return eraseImpl(key);
+  }
 
-      replacement->left   = node->left;
-      replacement->right  = node->right;
-      replacement->parent = node->parent;
+  void swap(this_type& other) noexcept
+  {
+    using std::swap;
 
-      Node* detached{node};
-      node = replacement;
-      return detached;
+    if constexpr (node_allocator_traits::propagate_on_container_swap::value) {
+      swap(m_nodeAllocator, other.m_nodeAllocator);
     }
 
-    // One child
-    Node* child{node->left == nullptr ? node->right : node->left};
-    Node* detached{node};
-    child->parent = node->parent;
-    node          = child;
-    return detached;
+    swap(m_root, other.m_root);
+    swap(m_nodeCount, other.m_nodeCount);
+    swap(m_compare, other.m_compare);
+    swap(m_extremes, other.m_extremes);
   }
 
-  Node* balance(Node* node)
+  /*!
+   * Moves the elements whose key is not less than key into the returned
+   * tree, the ones with a lesser key stay. No element is copied or moved.
+   * Takes O(log n) steps with orderStatistics. Otherwise the smaller one of
+   * both parts is counted as well, which takes O(log n + min(k, n - k))
+   * steps for k elements moved.
+   */
+  this_type split(const key_type& key)
   {
-    const ssize_type balanceFactor{calculateBalanceFactor(node)};
+    return splitImpl(key);
+  }
+
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  this_type split(const K& key)
+  {
+    return splitImpl(key);
+  }
 
-    // Right Right => rotate left
-    // left height (0) - right height (2) == -2
-    // right child has a left height of 0 and a right height of 1 -> -1 (because
-    // 0 - 1 == -1)
-    if (balanceFactor == -2 && calculateBalanceFactor(node->right) == -1) {
-      return rotateLeft(node);
+  /*!
+   * Moves all elements of other behind the ones of this tree in O(log n)
+   * steps, other is left empty. Joining a tree with itself does nothing.
+   * Throws std::invalid_argument if a key of other would have to go
+   * in front of a key of this tree or if other uses an unequal allocator.
+   */
+  void join(this_type&& other)
+  {
+    if (this == &other || other.empty()) {
+      return;
     }
 
-    // Left Left => rotate right
-    // left height (2) - right height (0) == 2
-    // left child has a left height of 1 and right height of 0 -> 1 (because 1 -
-    // 0 == 1)
-    if (balanceFactor == 2 && calculateBalanceFactor(node->left) == 1) {
-      return rotateRight(node);
+    if (other.m_nodeAllocator != m_nodeAllocator) {
+      throw std::invalid_argument{
+        "AvlTree::join: tree with an unequal allocator!"};
     }
 
-    // Right Left => rotate right left
-    // left height (0) - rigth height (2) == -2
-    // right child has a left height of 1 and right height of 0 -> 1 (because 1
-    // - 0 == 1)
-    if (balanceFactor == -2 && calculateBalanceFactor(node->right) == 1) {
-      node->right = rotateRight(node->right);
+    if (!empty()) {
+      const key_type& last{algorithms().rightmost(m_root)->key()};
+      const key_type& first{algorithms().leftmost(other.m_root)->key()};
 
-      if (node->right != nullptr) {
-        node->right->parent = node;
+      if (uniqueKeys ? !AT_CMPKEY(last, first) : AT_CMPKEY(first, last)) {
+        throw std::invalid_argument{
+          "AvlTree::join: the keys of the trees overlap!"};
       }
-
-      return rotateLeft(node);
     }
 
-    // Left Right => rotate left right
-    // left height (2) - right height (0) == 2
-    // left child has a left height of 0 and a right height of 1 -> -1 (because
-    // 0 - 1 == -1)
-    if (balanceFactor == 2 && calculateBalanceFactor(node->left) == -1) {
-      node->left = rotateLeft(node->left);
-
-      if (node->right != nullptr) {
-        node->left->parent = node;
-      }
+    m_nodeCount += other.m_nodeCount;
+    forgetExtremes();
+    other.forgetExtremes();
 
-      return rotateRight(node);
-    }
+    m_root            = algorithms().join(m_root, other.m_root);
+    other.m_root      = nullptr;
+    other.m_nodeCount = 0;
+  }
 
-    return node;
+  iterator find(const key_type& key)
+  {
+    return findImpl(key);
   }
 
-  Node* eraseImpl(const key_type& key, Node*& node, iterator* next)
+  const_iterator find(const key_type& key) const
   {
-    if (node == nullptr) {
-      return nullptr;
-    }
+    return const_cast<this_type*>(this)->find(key);
+  }
 
-    if (AT_CMPKEY(node->key(), key)) { // If key > node.key -> go right
-      node->right = eraseImpl(key, node->right, next);
+  /*!
+   * Looks for a key equivalent to key without constructing a key_type,
+   * only takes part in overload resolution if key_compare is transparent.
+   * The same goes for the other lookup functions taking a K.
+   */
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  iterator find(const K& key)
+  {
+    return findImpl(key);
+  }
 
-      if (node->right != nullptr) {
-        node->right->parent = node;
-      }
-    }
-    else if (AT_CMPKEY(key, node->key())) { // If key < node.key -> go left
-      node->left = eraseImpl(key, node->left, next);
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  const_iterator find(const K& key) const
+  {
+    return const_cast<this_type*>(this)->findImpl(key);
+  }
 
-      if (node->left != nullptr) {
-        node->left->parent = node;
-      }
-    }
-    else { // Found it.
-      *next = iterator{m_root, node};
-      ++(*next);
+  bool contains(const key_type& key) const
+  {
+    return find(key) != end();
+  }
 
-      Node* nodeToDelete{detachNode(node)};
-      delete nodeToDelete;
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  bool contains(const K& key) const
+  {
+    return find(key) != end();
+  }
 
-      --m_nodeCount;
-    }
+  size_type count(const key_type& key) const
+  {
+    return const_cast<this_type*>(this)->countImpl(key);
+  }
 
-    if (node == nullptr) {
-      return nullptr;
-    }
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  size_type count(const K& key) const
+  {
+    return const_cast<this_type*>(this)->countImpl(key);
+  }
 
-    node->height = std::max(heightOf(node->right), heightOf(node->left)) + 1;
+  /*!
+   * Returns an iterator to the first element whose key is not less than key,
+   * or end() if there is none.
+   */
+  iterator lower_bound(const key_type& key)
+  {
+    return lowerBound(key);
+  }
 
-    return balance(node);
+  const_iterator lower_bound(const key_type& key) const
+  {
+    return const_cast<this_type*>(this)->lowerBound(key);
   }
 
-  Node* insertImpl(
-    const key_type&    key,
-    const mapped_type& value,
-    Node*              node,
-    Node**             insertedOrPreventedInsertion,
-    bool*              didInsert,
-    bool               shouldReplace)
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  iterator lower_bound(const K& key)
   {
-    if (node == nullptr) { // Leaf node found -> replace it.
-      Node* nodeCreated{nullptr};
+    return lowerBound(key);
+  }
 
-      try {
-        nodeCreated                   = DBG_NEW Node{key, value};
-        *insertedOrPreventedInsertion = nodeCreated;
-        *didInsert                    = true;
-        return nodeCreated;
-      }
-      catch (...) {
-        delete nodeCreated;
-        throw;
-      }
-    }
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  const_iterator lower_bound(const K& key) const
+  {
+    return const_cast<this_type*>(this)->lowerBound(key);
+  }
 
-    if (AT_CMPKEY(node->key(), key)) { // If key > node.key -> go right
-      node->right = insertImpl(
-        key,
-        value,
-        node->right,
-        insertedOrPreventedInsertion,
-        didInsert,
-        shouldReplace);
+  /*!
+   * Returns an iterator to the first element whose key is greater than key,
+   * or end() if there is none.
+   */
+  iterator upper_bound(const key_type& key)
+  {
+    return upperBound(key);
+  }
 
-      if (node->right != nullptr) {
-        node->right->parent = node;
+  const_iterator upper_bound(const key_type& key) const
+  {
+    return const_cast<this_type*>(this)->upperBound(key);
+  }
+
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  iterator upper_bound(const K& key)
+  {
+    return upperBound(key);
+  }
+
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  const_iterator upper_bound(const K& key) const
+  {
+    return const_cast<this_type*>(this)->upperBound(key);
+  }
+
+  /*!
+   * Returns the range of the elements with a key equivalent to key,
+   * which is empty and located where key would go if there are none.
+   * Both ends are found in a single descent that only splits up at the
+   * first element with an equivalent key.
+   */
+  std::pair<iterator, iterator> equal_range(const key_type& key)
+  {
+    return equalRange(key);
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(
+    const key_type& key) const
+  {
+    return const_cast<this_type*>(this)->equal_range(key);
+  }
+
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  std::pair<iterator, iterator> equal_range(const K& key)
+  {
+    return equalRange(key);
+  }
+
+  template<typename K>
+    requires detail::Transparent<key_compare>
+  std::pair<const_iterator, const_iterator> equal_range(const K& key) const
+  {
+    return const_cast<this_type*>(this)->equal_range(key);
+  }
+
+  /*!
+   * Returns an iterator to the element at index in key order,
+   * or end() if index >= size(). Needs orderStatistics.
+   */
+  iterator nth(size_type index)
+    requires orderStatistics
+  {
+    iterator it{end()};
+    it.moveTo(index);
+    return it;
+  }
+
+  const_iterator nth(size_type index) const
+    requires orderStatistics
+  {
+    return const_cast<this_type*>(this)->nth(index);
+  }
+
+  /*!
+   * Returns the number of elements whose key is less than key, which is the
+   * index of lower_bound(key). Needs orderStatistics.
+   */
+  size_type rank(const key_type& key) const
+    requires orderStatistics
+  {
+    return rankOf(key);
+  }
+
+  template<typename K>
+    requires(detail::Transparent<key_compare> && orderStatistics)
+  size_type rank(const K& key) const
+  {
+    return rankOf(key);
+  }
+
+  /*!
+   * Returns the number of elements whose key is in [low, high).
+   * Needs orderStatistics.
+   */
+  size_type count_range(const key_type& low, const key_type& high) const
+    requires orderStatistics
+  {
+    return countRange(low, high);
+  }
+
+  template<typename K>
+    requires(detail::Transparent<key_compare> && orderStatistics)
+  size_type count_range(const K& low, const K& high) const
+  {
+    return countRange(low, high);
+  }
+
+  /*!
+   * Returns the aggregate of all elements in key order, see
+   * AvlTreeTraits::Aggregate.
+   */
+  AggregateValue aggregate() const
+    requires hasAggregate
+  {
+    return m_root == nullptr ? Aggregate::identity() : m_root->aggregate;
+  }
+
+  /*!
+   * Returns the aggregate of the elements whose key is in [low, high)
+   * in O(log n) steps.
+   */
+  AggregateValue aggregate(const key_type& low, const key_type& high) const
+    requires hasAggregate
+  {
+    return aggregateRange(low, high);
+  }
+
+  template<typename K>
+    requires(detail::Transparent<key_compare> && hasAggregate)
+  AggregateValue aggregate(const K& low, const K& high) const
+  {
+    return aggregateRange(low, high);
+  }
+
+  /*!
+   * Applies change to the mapped values of the elements whose key is in
+   * [low, high) in O(log n) steps, see AvlTreeTraits::RangeUpdate.
+   */
+  template<typename Change>
+    requires(hasRangeUpdate && !isSet)
+  void range_apply(
+    const key_type& low,
+    const key_type& high,
+    const Change&   change)
+  {
+    applyRange(m_root, low, high, change, false, false);
+  }
+
+  template<typename K, typename Change>
+    requires(detail::Transparent<key_compare> && hasRangeUpdate && !isSet)
+  void range_apply(const K& low, const K& high, const Change& change)
+  {
+    applyRange(m_root, low, high, change, false, false);
+  }
+
+  /*!
+   * Returns an iterator to an element picked uniformly at random using
+   * urbg, or end() if the tree is empty. Needs orderStatistics.
+   */
+  template<typename URBG>
+    requires orderStatistics
+  iterator sample(URBG& urbg)
+  {
+    if (empty()) {
+      return end();
+    }
+
+    std::uniform_int_distribution<size_type> distribution{0, size() - 1};
+    return nth(distribution(urbg));
+  }
+
+  template<typename URBG>
+    requires orderStatistics
+  const_iterator sample(URBG& urbg) const
+  {
+    return const_cast<this_type*>(this)->sample(urbg);
+  }
+
+private:
+  template<typename K>
+  this_type splitImpl(const K& key)
+  {
+    this_type upper{m_compare, get_allocator()};
+    auto      goesLeft{[this, &key](Node* node) {
+      return AT_CMPKEY(node->key(), key);
+    }};
+    algorithms().split(m_root, goesLeft, &m_root, &upper.m_root);
+
+    if constexpr (orderStatistics) {
+      upper.m_nodeCount = subtreeSizeOf(upper.m_root);
+    }
+    else {
+      // Walks both parts in lockstep until the smaller one runs out.
+      const_iterator lowerIt{cbegin()};
+      const_iterator upperIt{upper.cbegin()};
+      size_type      counted{0};
+
+      while (lowerIt != cend() && upperIt != upper.cend()) {
+        ++lowerIt;
+        ++upperIt;
+        ++counted;
+      }
+
+      upper.m_nodeCount
+        = upperIt == upper.cend() ? counted : m_nodeCount - counted;
+    }
+
+    m_nodeCount -= upper.m_nodeCount;
+    forgetExtremes();
+    return upper;
+  }
+
+  static allocator_type copyConstructionAllocator(const this_type& other)
+  {
+    return allocator_type{
+      node_allocator_traits::select_on_container_copy_construction(
+        other.m_nodeAllocator)};
+  }
+
+  static Algorithms algorithms()
+  {
+    return Algorithms{Links{}};
+  }
+
+  static size_type subtreeSizeOf(const Node* node)
+  {
+    return node == nullptr ? 0 : node->subtreeSize;
+  }
+
+  // The key of an element, or of an element of a range to be inserted.
+  template<typename Element>
+  static const auto& keyOf(const Element& element)
+  {
+    if constexpr (isSet) {
+      return element;
+    }
+    else {
+      return element.first;
+    }
+  }
+
+  // Whether keyOf(element) refers to a key_type without any conversion.
+  template<typename Element>
+  static constexpr bool hasKeyOfType{[] {
+    if constexpr (isSet) {
+      return std::is_same_v<std::remove_cvref_t<Element>, key_type>;
+    }
+    else {
+      return requires(const Element& element) {
+        requires std::is_same_v<
+          std::remove_cvref_t<decltype(element.first)>,
+          key_type>;
+      };
+    }
+  }()};
+
+  // Clones the shape of other, which takes no comparisons and no rotations.
+  void copy(const this_type& other)
+  {
+    m_root      = cloneTree(other.m_root);
+    m_nodeCount = other.m_nodeCount;
+    forgetExtremes();
+  }
+
+  // Returns whether the keys in [first, last) never decrease.
+  template<typename ForwardIterator>
+  bool isSorted(
+    ForwardIterator first,
+    ForwardIterator last,
+    size_type*      distinctCount)
+  {
+    *distinctCount = 0;
+
+    if (first == last) {
+      return true;
+    }
+
+    *distinctCount = 1;
+
+    for (ForwardIterator previous{first++}; first != last; previous = first++) {
+      if (AT_CMPKEY(keyOf(*first), keyOf(*previous))) {
+        return false;
+      }
+
+      if (AT_CMPKEY(keyOf(*previous), keyOf(*first))) {
+        ++*distinctCount;
+      }
+    }
+
+    return true;
+  }
+
+  // Builds the tree from the next count elements at first, to be called on
+  // an empty tree. advance moves first to the following element.
+  template<typename Iterator, typename Advance>
+  void buildTree(Iterator first, const Advance& advance, size_type count)
+  {
+    int height{0};
+    m_root      = buildSubtree(first, advance, count, &height);
+    m_nodeCount = count;
+    forgetExtremes();
+  }
+
+  // Builds a perfectly balanced subtree bottom-up, in order,
+  // and sets *height to its height.
+  template<typename Iterator, typename Advance>
+  Node* buildSubtree(
+    Iterator&      first,
+    const Advance& advance,
+    size_type      count,
+    int*           height)
+  {
+    if (count == 0) {
+      *height = 0;
+      return nullptr;
+    }
+
+    // The right subtree gets the extra node if there is one.
+    const size_type leftCount{(count - 1) / 2};
+    int             leftHeight{0};
+    int             rightHeight{0};
+    Node*           left{buildSubtree(first, advance, leftCount, &leftHeight)};
+    Node*           node{nullptr};
+
+    try {
+      node = createNode(*first);
+    }
+    catch (...) {
+      destroyTree(left);
+      throw;
+    }
+
+    node->setLeft(left);
+
+    if (left != nullptr) {
+      left->setParent(node);
+    }
+
+    try {
+      advance(first);
+      node->setRight(
+        buildSubtree(first, advance, count - 1 - leftCount, &rightHeight));
+    }
+    catch (...) {
+      destroyTree(node);
+      throw;
+    }
+
+    if (node->right() != nullptr) {
+      node->right()->setParent(node);
+    }
+
+    node->setBalance(leftHeight - rightHeight);
+    algorithms().update(node);
+    *height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+  }
+
+  Node* cloneTree(const Node* other)
+  {
+    if (other == nullptr) {
+      return nullptr;
+    }
+
+    // Pending updates are copied along with the element they are pending
+    // for, so the subtree data is copied rather than recomputed.
+    Node* node{createNode(other->element)};
+    node->setBalance(other->balance());
+    node->subtreeSize = other->subtreeSize;
+    node->aggregate   = other->aggregate;
+    node->pending     = other->pending;
+
+    try {
+      node->setLeft(cloneTree(other->left()));
+
+      if (node->left() != nullptr) {
+        node->left()->setParent(node);
+      }
+
+      node->setRight(cloneTree(other->right()));
+
+      if (node->right() != nullptr) {
+        node->right()->setParent(node);
+      }
+    }
+    catch (...) {
+      destroyTree(node);
+      throw;
+    }
+
+    return node;
+  }
+
+  void destroyTree(Node* node) noexcept
+  {
+    destroyTree(m_nodeAllocator, node, static_cast<std::size_t>(-1));
+  }
+
+  // Rotates left children up until the root has none, then destroys the
+  // root. Needs neither recursion nor a stack.
+  // Stops after budget steps and returns what is left of the tree.
+  static Node* destroyTree(
+    node_allocator_type& nodeAllocator,
+    Node*                node,
+    std::size_t          budget) noexcept
+  {
+    for (; node != nullptr && budget != 0; --budget) {
+      Node* left{node->left()};
+
+      if (left != nullptr) {
+        node->setLeft(left->right());
+        left->setRight(node);
+        node = left;
+      }
+      else {
+        Node* right{node->right()};
+        destroyNode(nodeAllocator, node);
+        node = right;
+      }
+    }
+
+    return node;
+  }
+
+  // Whether other allocators use the storage of nodeAllocator as well.
+  static bool isShared(const node_allocator_type& nodeAllocator) noexcept
+  {
+    if constexpr (requires {
+                    { nodeAllocator.use_count() } -> std::convertible_to<long>;
+                  }) {
+      return nodeAllocator.use_count() > 1;
+    }
+    else {
+      return false;
+    }
+  }
+
+  // Returns the storage of all nodes at once if the nodes need no
+  // destructor calls and the allocator can do that, returns whether it did.
+  static bool releaseAllNodes(node_allocator_type& nodeAllocator) noexcept
+  {
+    if constexpr (
+      std::is_trivially_destructible_v<Node>
+      && requires(node_allocator_type& allocator) {
+           { allocator.release() } -> std::same_as<bool>;
+         }) {
+      return nodeAllocator.release();
+    }
+    else {
+      return false;
+    }
+  }
+
+  template<typename... Args>
+  Node* createNode(Args&&... args)
+  {
+    Node* node{node_allocator_traits::allocate(m_nodeAllocator, 1)};
+
+    try {
+      node_allocator_traits::construct(
+        m_nodeAllocator, node, std::forward<Args>(args)...);
+    }
+    catch (...) {
+      node_allocator_traits::deallocate(m_nodeAllocator, node, 1);
+      throw;
+    }
+
+    return node;
+  }
+
+  void destroyNode(Node* node) noexcept
+  {
+    destroyNode(m_nodeAllocator, node);
+  }
+
+  static void destroyNode(
+    node_allocator_type& nodeAllocator,
+    Node*                node) noexcept
+  {
+    node_allocator_traits::destroy(nodeAllocator, node);
+    node_allocator_traits::deallocate(nodeAllocator, node, 1);
+  }
+
+  // Creates an iterator to node, which may be nullptr for the end iterator.
+  iterator iteratorTo(Node* target)
+  {
+    iterator it{end()};
+
+    if constexpr (hasParentLinks) {
+      it.m_node = target;
+    }
+    else if (target != nullptr) {
+      Node* node{m_root};
+      it.descend(node);
+
+      while (node != target) {
+        node = AT_CMPKEY(target->key(), node->key()) ? node->left()
+                                                      : node->right();
+        it.descend(node);
+      }
+    }
+
+    return it;
+  }
+
+  // Inserts the node returned by createNode like insertNode, but looks for
+  // its position next to hint first.
+  template<typename CreateNode>
+  iterator insertNodeNear(
+    const_iterator  hint,
+    const key_type& key,
+    CreateNode&&    createNode)
+  {
+    // Whether key goes before or after node, equivalent keys go before and
+    // after each other if they are allowed.
+    const auto before{[&](Node* node) {
+      return uniqueKeys ? AT_CMPKEY(key, node->key())
+                        : !AT_CMPKEY(node->key(), key);
+    }};
+    const auto after{[&](Node* node) {
+      return uniqueKeys ? AT_CMPKEY(node->key(), key)
+                        : !AT_CMPKEY(key, node->key());
+    }};
+    const iterator position{hint.m_it};
+    iterator       parent{end()};
+    int            direction{0};
+
+    if (empty()) {
+      return insertNode(key, createNode).first;
+    }
+
+    if (position.m_node == nullptr || before(position.m_node)) {
+      const iterator previous{previousOf(position)};
+
+      if (previous.m_node == nullptr || after(previous.m_node)) {
+        // Between previous and position, one of them has a free slot.
+        if (previous.m_node != nullptr && previous.m_node->right() == nullptr) {
+          parent    = previous;
+          direction = 1;
+        }
+        else {
+          parent    = position;
+          direction = -1;
+        }
+      }
+    }
+    else if (after(position.m_node)) {
+      const iterator next{nextOf(position)};
+
+      if (next.m_node == nullptr || before(next.m_node)) {
+        if (position.m_node->right() == nullptr) {
+          parent    = position;
+          direction = 1;
+        }
+        else {
+          parent    = next;
+          direction = -1;
+        }
+      }
+      else if constexpr (!uniqueKeys) {
+        // hint is too far ahead, it goes as close to it as possible.
+        return insertNodeFirst(key, createNode);
+      }
+    }
+    else { // It's already there, which only unique keys get to.
+      return position;
+    }
+
+    if (direction == 0) {
+      return insertNode(key, createNode).first;
+    }
+
+    Node* const created{createNode()};
+    ++m_nodeCount;
+
+    if constexpr (hasParentLinks) {
+      KnownExtremes& extremes{knownExtremes()};
+
+      if (direction < 0 && parent.m_node == extremes.first) {
+        extremes.first = created;
+      }
+      else if (direction > 0 && parent.m_node == extremes.last) {
+        extremes.last = created;
+      }
+
+      pushDownTo(parent);
+      m_root = algorithms().insertBelow(
+        m_root, parent.m_node, direction, created);
+      return iteratorTo(created);
+    }
+    else {
+      // Follow the path to parent instead of comparing keys.
+      Node* const            target{parent.m_node};
+      detail::NodePath<Node> path{pathUpFrom(parent)};
+      DescentPath          descent{};
+      auto locate{[&path, &descent, target, direction](Node* node) {
+        path.pop();
+        const int side{
+          node == target ? direction
+                         : (path.top() == node->left() ? -1 : 1)};
+        descent.push(node, side);
+        return side;
+      }};
+      auto  link{[created] { return created; }};
+      Node* inserted{nullptr};
+      m_root = algorithms().insertAt(m_root, locate, link, &inserted);
+      return iteratorToInserted(descent, created);
+    }
+  }
+
+  // The nodes an insertion or erasure without parent links passed on its way
+  // down and the side it took at each of them.
+  struct DescentPath {
+    void push(Node* node, int direction)
+    {
+      nodes[size]      = node;
+      directions[size] = static_cast<signed char>(direction);
+      ++size;
+    }
+
+    std::array<Node*, detail::maximumHeight()>       nodes;
+    std::array<signed char, detail::maximumHeight()> directions;
+    std::size_t                                      size{0};
+  };
+
+  // Creates an iterator to created, which was inserted at the end of path,
+  // in O(log n) steps without looking at any keys, which may be equivalent
+  // or moved from. Rebalancing only rearranges nodes of path and keeps the
+  // side of each of them that created is on, and it moves none of them
+  // more than two places up.
+  iterator iteratorToInserted(const DescentPath& path, Node* created)
+  {
+    iterator    it{end()};
+    std::size_t index{0};
+
+    for (Node* node{m_root};;) {
+      it.descend(node);
+
+      if (node == created) {
+        return it;
+      }
+
+      index = index < 2 ? 0 : index - 2;
+
+      while (path.nodes[index] != node) {
+        ++index;
+      }
+
+      node = path.directions[index] < 0 ? node->left() : node->right();
+    }
+  }
+
+  // Creates an iterator to next, the successor of the node erased at the end
+  // of path, in O(log n) steps without looking at any keys.
+  // Rebalancing after an erasure keeps the order of the nodes of path above
+  // next, but may rotate a node from the other side of one of them in just
+  // above it, which has next on the same side.
+  iterator iteratorToSuccessor(const DescentPath& path, Node* next)
+  {
+    iterator    it{end()};
+    std::size_t index{0};
+
+    if (next == nullptr) {
+      return it;
+    }
+
+    for (Node* node{m_root};;) {
+      it.descend(node);
+
+      if (node == next) {
+        return it;
+      }
+
+      const int direction{path.directions[index]};
+
+      if (node == path.nodes[index]) {
+        ++index;
+      }
+
+      node = direction < 0 ? node->left() : node->right();
+    }
+  }
+
+  template<typename K>
+  size_type rankOf(const K& key) const
+  {
+    size_type rank{0};
+
+    for (Node* node{m_root}; node != nullptr;) {
+      if (AT_CMPKEY(node->key(), key)) {
+        rank += subtreeSizeOf(node->left()) + 1;
+        node = node->right();
+      }
+      else {
+        node = node->left();
+      }
+    }
+
+    return rank;
+  }
+
+  static AggregateValue aggregateOf(const Node* node)
+  {
+    return node == nullptr ? Aggregate::identity() : node->aggregate;
+  }
+
+  // Splits up at the highest node in [low, high), the range then covers
+  // a suffix of its left subtree and a prefix of its right subtree.
+  template<typename K>
+  AggregateValue aggregateRange(const K& low, const K& high) const
+  {
+    Node* split{m_root};
+
+    while (split != nullptr) {
+      algorithms().push(split);
+
+      if (AT_CMPKEY(split->key(), low)) {
+        split = split->right();
+      }
+      else if (!AT_CMPKEY(split->key(), high)) {
+        split = split->left();
+      }
+      else {
+        break;
+      }
+    }
+
+    if (split == nullptr) {
+      return Aggregate::identity();
+    }
+
+    AggregateValue suffix{Aggregate::identity()};
+
+    for (Node* node{split->left()}; node != nullptr;) {
+      algorithms().push(node);
+
+      if (AT_CMPKEY(node->key(), low)) {
+        node = node->right();
+      }
+      else {
+        suffix = Aggregate::combine(
+          Aggregate::combine(
+            Aggregate::of(node->element), aggregateOf(node->right())),
+          suffix);
+        node = node->left();
+      }
+    }
+
+    AggregateValue prefix{Aggregate::identity()};
+
+    for (Node* node{split->right()}; node != nullptr;) {
+      algorithms().push(node);
+
+      if (AT_CMPKEY(node->key(), high)) {
+        prefix = Aggregate::combine(
+          prefix,
+          Aggregate::combine(
+            aggregateOf(node->left()), Aggregate::of(node->element)));
+        node = node->right();
+      }
+      else {
+        node = node->left();
+      }
+    }
+
+    return Aggregate::combine(
+      Aggregate::combine(suffix, Aggregate::of(split->element)), prefix);
+  }
+
+  // Applies change to the element, the aggregate and the pending update of
+  // node, its children follow when node is pushed.
+  template<typename Change>
+  static void applyToSubtree(Node* node, const Change& change)
+  {
+    RangeUpdate::apply(change, node->value());
+
+    if constexpr (hasAggregate) {
+      RangeUpdate::applyToAggregate(change, node->aggregate);
+    }
+
+    if (node->pending.has_value()) {
+      node->pending = RangeUpdate::compose(*node->pending, change);
+    }
+    else {
+      node->pending = change;
+    }
+  }
+
+  // Whole subtrees in [low, high) take the change at their root, which
+  // leaves at most two paths to descend.
+  // aboveLow and belowHigh tell whether all keys of the subtree of node
+  // are known to be at least low and below high.
+  template<typename K, typename Change>
+  void applyRange(
+    Node*         node,
+    const K&      low,
+    const K&      high,
+    const Change& change,
+    bool          aboveLow,
+    bool          belowHigh)
+  {
+    if (node == nullptr) {
+      return;
+    }
+
+    if (aboveLow && belowHigh) {
+      applyToSubtree(node, change);
+      return;
+    }
+
+    algorithms().push(node);
+    const bool nodeAboveLow{aboveLow || !AT_CMPKEY(node->key(), low)};
+    const bool nodeBelowHigh{belowHigh || AT_CMPKEY(node->key(), high)};
+
+    if (nodeAboveLow && nodeBelowHigh) {
+      RangeUpdate::apply(change, node->value());
+    }
+
+    if (nodeAboveLow) {
+      applyRange(node->left(), low, high, change, aboveLow, nodeBelowHigh);
+    }
+
+    if (nodeBelowHigh) {
+      applyRange(node->right(), low, high, change, nodeAboveLow, belowHigh);
+    }
+
+    algorithms().update(node);
+  }
+
+  // Hands pending updates down the path from the root to the node of it,
+  // including that node.
+  static void pushDownTo(const iterator& it)
+  {
+    if constexpr (hasRangeUpdate) {
+      for (detail::NodePath<Node> path{pathUpFrom(it)}; !path.empty();
+           path.pop()) {
+        algorithms().push(path.top());
+      }
+    }
+  }
+
+  // Updates the node of it and all of its ancestors, bottom-up.
+  static void updateUpFrom(const iterator& it)
+  {
+    if constexpr (hasParentLinks) {
+      for (Node* node{it.m_node}; node != nullptr; node = node->parent()) {
+        algorithms().update(node);
+      }
+    }
+    else {
+      for (detail::NodePath<Node> path{it.m_path}; !path.empty();
+           path.pop()) {
+        algorithms().update(path.top());
+      }
+    }
+  }
+
+  template<typename K>
+  size_type countRange(const K& low, const K& high) const
+  {
+    if (!AT_CMPKEY(low, high)) {
+      return 0;
+    }
+
+    return rankOf(high) - rankOf(low);
+  }
+
+  template<typename K>
+  size_type countImpl(const K& key)
+  {
+    if constexpr (uniqueKeys) {
+      return findImpl(key) == end() ? 0 : 1;
+    }
+    else {
+      const std::pair<iterator, iterator> range{
+        lowerBound(key), upperBound(key)};
+      return static_cast<size_type>(std::distance(range.first, range.second));
+    }
+  }
+
+  template<typename K>
+  iterator findImpl(const K& key)
+  {
+    iterator it{end()};
+    Node*    node{m_root};
+
+    while (node != nullptr) {
+      it.descend(node);
+      const int direction{
+        detail::compareThreeWay(m_compare, key, node->key())};
+
+      if (direction < 0) { // If key < node.key -> go left.
+        node = node->left();
+      }
+      else if (direction > 0) { // If key > node.key -> go right.
+        node = node->right();
+      }
+      else { // Found it.
+        return it;
+      }
+    }
+
+    return end();
+  }
+
+  template<typename K>
+  iterator eraseImpl(const K& key)
+  {
+    if (empty()) {
+      return end();
+    }
+
+    if constexpr (!uniqueKeys) {
+      const size_type nodeCount{m_nodeCount};
+      Node*           next{nullptr};
+      auto            destroyAndCount{[this](Node* node) {
+        destroyNode(node);
+        --m_nodeCount;
+      }};
+      m_root = algorithms().detachEquivalent(
+        m_root, key, m_compare, destroyAndCount, &next);
+
+      if (m_nodeCount == nodeCount) {
+        return end();
+      }
+
+      forgetExtremes();
+
+      // Without parent links iteratorTo can't tell next apart from the
+      // nodes with an equivalent key behind it.
+      if constexpr (hasParentLinks) {
+        return iteratorTo(next);
+      }
+      else {
+        return upperBound(key);
+      }
+    }
+
+    Node*       erased{nullptr};
+    Node*       next{nullptr};
+    DescentPath descent{};
+    auto        locate{[&](Node* node) {
+      const int side{detail::compareThreeWay(m_compare, key, node->key())};
+
+      if constexpr (!hasParentLinks) {
+        // Where the erased node was its successor comes after it.
+        descent.push(node, side == 0 ? 1 : side);
+      }
+
+      return side;
+    }};
+    m_root = algorithms().detachAt(m_root, locate, &erased, &next);
+
+    if (erased != nullptr) {
+      destroyNode(erased);
+      --m_nodeCount;
+      forgetExtremes();
+    }
+
+    if constexpr (hasParentLinks) {
+      return iteratorTo(next);
+    }
+    else {
+      return iteratorToSuccessor(descent, next);
+    }
+  }
+
+  // Returns an iterator to the first element whose key is not less than key.
+  template<typename K>
+  iterator lowerBound(const K& key)
+  {
+    return bound(end(), m_root, nullptr, [&](Node* node) {
+      return !AT_CMPKEY(node->key(), key);
+    });
+  }
+
+  // Returns an iterator to the first element whose key is greater than key.
+  template<typename K>
+  iterator upperBound(const K& key)
+  {
+    return bound(end(), m_root, nullptr, [&](Node* node) {
+      return AT_CMPKEY(key, node->key());
+    });
+  }
+
+  template<typename K>
+  std::pair<iterator, iterator> equalRange(const K& key)
+  {
+    const auto isLowerBound{
+      [&](Node* node) { return !AT_CMPKEY(node->key(), key); }};
+    const auto isUpperBound{
+      [&](Node* node) { return AT_CMPKEY(key, node->key()); }};
+    iterator   it{end()};
+    Node*      upper{nullptr};
+
+    for (Node* node{m_root}; node != nullptr;) {
+      it.descend(node);
+
+      if (AT_CMPKEY(key, node->key())) {
+        upper = node;
+        node  = node->left();
+      }
+      else if (AT_CMPKEY(node->key(), key)) {
+        node = node->right();
+      }
+      else { // The bounds are in the subtrees of node, or node itself.
+        return {
+          bound(it, node->left(), node, isLowerBound),
+          bound(it, node->right(), upper, isUpperBound)};
+      }
+    }
+
+    it.ascendTo(upper);
+    return {it, it};
+  }
+
+  // Returns an iterator to the first node for which isBound holds,
+  // looking in the subtree of node first and falling back to candidate.
+  // it is at the parent of node, candidate is nullptr or on the path to it.
+  // isBound must not hold for any node before one it holds for.
+  template<typename IsBound>
+  iterator bound(
+    iterator       it,
+    Node*          node,
+    Node*          candidate,
+    const IsBound& isBound)
+  {
+    while (node != nullptr) {
+      it.descend(node);
+
+      if (isBound(node)) {
+        candidate = node;
+        node      = node->left();
+      }
+      else {
+        node = node->right();
       }
     }
-    else if (AT_CMPKEY(key, node->key())) { // If key < node.key -> go left
-      node->left = insertImpl(
-        key,
-        value,
-        node->left,
-        insertedOrPreventedInsertion,
-        didInsert,
-        shouldReplace);
 
-      if (node->left != nullptr) {
-        node->left->parent = node;
+    it.ascendTo(candidate);
+    return it;
+  }
+
+  // Returns the nodes from the one of it up to the root, the root on top.
+  static detail::NodePath<Node> pathUpFrom(const iterator& it)
+  {
+    detail::NodePath<Node> path{};
+
+    if constexpr (hasParentLinks) {
+      for (Node* node{it.m_node}; node != nullptr; node = node->parent()) {
+        path.push(node);
+      }
+    }
+    else {
+      detail::NodePath<Node> pathDown{it.m_path};
+
+      while (!pathDown.empty()) {
+        path.push(pathDown.top());
+        pathDown.pop();
+      }
+    }
+
+    return path;
+  }
+
+  template<typename KeyType, typename Mapped>
+  std::pair<iterator, bool> insertOrAssign(KeyType&& key, Mapped&& value)
+  {
+    std::pair<iterator, bool> result{insertNode(key, [&] {
+      return createNode(
+        std::forward<KeyType>(key), std::forward<Mapped>(value));
+    })};
+
+    if (!result.second) {
+      result.first.m_node->value() = std::forward<Mapped>(value);
+      updateUpFrom(result.first);
+    }
+
+    return result;
+  }
+
+  // Inserts the node returned by createNode unless key is already present
+  // and keys are unique, createNode is only called if a node is to be
+  // inserted.
+  template<typename CreateNode>
+  std::pair<iterator, bool> insertNode(
+    const key_type& key,
+    CreateNode&&    createNode)
+  {
+    const size_type nodeCount{m_nodeCount};
+    Node*           nodeInserted{nullptr};
+    auto            createAndCount{[&] {
+      Node* node{createNode()};
+      ++m_nodeCount;
+      return node;
+    }};
+
+    DescentPath descent{};
+    auto        locate{[&](Node* node) {
+      // Equivalent keys go behind each other if they are allowed.
+      const int side{
+        uniqueKeys ? detail::compareThreeWay(m_compare, key, node->key())
+                   : (AT_CMPKEY(key, node->key()) ? -1 : 1)};
+
+      if constexpr (!hasParentLinks) {
+        if (side != 0) {
+          descent.push(node, side);
+        }
       }
+
+      return side;
+    }};
+    m_root
+      = algorithms().insertAt(m_root, locate, createAndCount, &nodeInserted);
+
+    if (m_nodeCount != nodeCount) {
+      forgetExtremes();
+    }
+
+    if constexpr (hasParentLinks) {
+      return {iteratorTo(nodeInserted), m_nodeCount != nodeCount};
     }
-    else { // It's already there.
-      *insertedOrPreventedInsertion = node;
-      *didInsert                    = false;
+    else {
+      return {
+        iteratorToInserted(descent, nodeInserted), m_nodeCount != nodeCount};
+    }
+  }
+
+  // Inserts the node returned by createNode in front of all nodes with an
+  // equivalent key, for trees that allow them.
+  template<typename CreateNode>
+  iterator insertNodeFirst(const key_type& key, CreateNode&& createNode)
+  {
+    Node*         nodeInserted{nullptr};
+    DescentPath descent{};
+    auto          locate{[&](Node* node) {
+      const int side{AT_CMPKEY(node->key(), key) ? 1 : -1};
 
-      if (shouldReplace) {
-        node->keyValuePair.second = value;
+      if constexpr (!hasParentLinks) {
+        descent.push(node, side);
       }
 
+      return side;
+    }};
+    auto          createAndCount{[&] {
+      Node* node{createNode()};
+      ++m_nodeCount;
       return node;
+    }};
+    m_root
+      = algorithms().insertAt(m_root, locate, createAndCount, &nodeInserted);
+    forgetExtremes();
+
+    // Without parent links iteratorTo only finds the last one of several
+    // equivalent keys, and key may have been moved into the new node.
+    if constexpr (hasParentLinks) {
+      return iteratorTo(nodeInserted);
+    }
+    else {
+      return iteratorToInserted(descent, nodeInserted);
+    }
+  }
+
+  // Returns the first and the last node, finds them again if they are
+  // unknown. Requires parent links.
+  KnownExtremes& knownExtremes()
+  {
+    if (m_extremes.first == nullptr && m_root != nullptr) {
+      m_extremes.first = algorithms().leftmost(m_root);
+      m_extremes.last  = algorithms().rightmost(m_root);
+    }
+
+    return m_extremes;
+  }
+
+  // To be called whenever nodes come or go other than by insertNodeNear.
+  void forgetExtremes() noexcept
+  {
+    m_extremes = Extremes{};
+  }
+
+  // Like --it and ++it, but at either end of the tree the extremes tell that
+  // there is nothing beyond in constant time.
+  iterator previousOf(iterator it)
+  {
+    if constexpr (hasParentLinks) {
+      if (it.m_node == nullptr) {
+        return iteratorTo(knownExtremes().last);
+      }
+
+      if (it.m_node == knownExtremes().first) {
+        return end();
+      }
     }
 
-    node->height = std::max(heightOf(node->right), heightOf(node->left)) + 1;
+    return --it;
+  }
+
+  iterator nextOf(iterator it)
+  {
+    if constexpr (hasParentLinks) {
+      if (it.m_node == knownExtremes().last) {
+        return end();
+      }
+    }
 
-    return balance(node);
+    return ++it;
   }
 
-  Node*     m_root;
-  size_type m_nodeCount;
+  Node*                                     m_root;
+  size_type                                 m_nodeCount;
+  [[no_unique_address]] key_compare         m_compare;
+  [[no_unique_address]] node_allocator_type m_nodeAllocator;
+  [[no_unique_address]] Extremes            m_extremes{};
 };
 
 #undef AT_CMPKEY
 
-template<typename Key, typename T, typename Compare = std::less<Key>>
-void swap(AvlTree<Key, T, Compare>& lhs, AvlTree<Key, T, Compare>& rhs) noexcept
+/*!
+ * Ordered set based on an AVL tree, whose nodes store nothing but the key.
+ */
+template<
+  typename Key,
+  typename Compare   = std::less<Key>,
+  typename Allocator = std::allocator<Key>,
+  typename Traits    = AvlTreeTraits>
+using AvlSet = AvlTree<Key, void, Compare, Allocator, Traits>;
+
+/*!
+ * AvlTree that allows several elements with equivalent keys.
+ * They are kept in the order they were inserted in.
+ */
+template<
+  typename Key,
+  typename T,
+  typename Compare   = std::less<Key>,
+  typename Allocator = std::allocator<std::pair<const Key, T>>,
+  typename Traits    = AvlTreeTraits>
+using AvlMultimap
+  = AvlTree<Key, T, Compare, Allocator, detail::MultiKeyTraits<Traits>>;
+
+/*!
+ * AvlSet that allows several equivalent keys.
+ */
+template<
+  typename Key,
+  typename Compare   = std::less<Key>,
+  typename Allocator = std::allocator<Key>,
+  typename Traits    = AvlTreeTraits>
+using AvlMultiset
+  = AvlTree<Key, void, Compare, Allocator, detail::MultiKeyTraits<Traits>>;
+
+template<
+  typename Key,
+  typename T,
+  typename Compare,
+  typename Allocator,
+  typename Traits>
+void swap(
+  AvlTree<Key, T, Compare, Allocator, Traits>& lhs,
+  AvlTree<Key, T, Compare, Allocator, Traits>& rhs) noexcept
 {
   lhs.swap(rhs);
 }
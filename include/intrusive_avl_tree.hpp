@@ -0,0 +1,506 @@
+#pragma once
+#include <cstddef>
+
+#include <functional>
+#include <iterator>
+#include <locale>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "avl_algorithms.hpp"
+
+namespace at {
+template<typename Value, typename KeyOfValue, typename Compare>
+class IntrusiveAvlTree;
+
+/*!
+ * The links an element of an IntrusiveAvlTree carries around,
+ * elements derive from it.
+ * Copying an element doesn't copy its links, the copy is not in any tree.
+ */
+class AvlHook : private detail::NodeLinks<AvlHook, true> {
+public:
+  AvlHook() = default;
+
+  AvlHook(const AvlHook&) : AvlHook{}
+  {
+  }
+
+  AvlHook& operator=(const AvlHook&)
+  {
+    return *this;
+  }
+
+private:
+  template<typename Value, typename KeyOfValue, typename Compare>
+  friend class IntrusiveAvlTree;
+
+  friend struct detail::NodePointerLinks<AvlHook>;
+};
+
+/*!
+ * AVL tree of elements that are owned by someone else.
+ * The elements derive from AvlHook, the tree only links them together,
+ * so insert and erase never allocate and don't throw.
+ * KeyOfValue returns the key of an element, which must not change
+ * while the element is in the tree.
+ * Compare and KeyOfValue must not throw.
+ * Elements must outlive their membership, the tree never destroys them.
+ */
+template<
+  typename Value,
+  typename KeyOfValue,
+  typename Compare = std::less<
+    std::remove_cvref_t<std::invoke_result_t<KeyOfValue, const Value&>>>>
+class IntrusiveAvlTree {
+public:
+  using this_type       = IntrusiveAvlTree;
+  using key_type        = std::remove_cvref_t<
+    std::invoke_result_t<KeyOfValue, const Value&>>;
+  using value_type      = Value;
+  using size_type       = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using key_compare     = Compare;
+  using reference       = value_type&;
+  using const_reference = const value_type&;
+  using pointer         = value_type*;
+  using const_pointer   = const value_type*;
+
+  static_assert(
+    std::is_base_of_v<AvlHook, value_type>,
+    "IntrusiveAvlTree: the elements have to derive from AvlHook.");
+
+  class const_iterator;
+
+private:
+  struct Links : detail::NodePointerLinks<AvlHook> {
+    decltype(auto) key(AvlHook* hook) const
+    {
+      return KeyOfValue{}(*static_cast<const value_type*>(hook));
+    }
+  };
+
+  using Algorithms = detail::AvlAlgorithms<Links>;
+
+public:
+  class iterator {
+  public:
+    using difference_type   = typename IntrusiveAvlTree::difference_type;
+    using value_type        = typename IntrusiveAvlTree::value_type;
+    using pointer           = value_type*;
+    using reference         = value_type&;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using iterator_concept  = std::bidirectional_iterator_tag; // C++20
+
+    friend class IntrusiveAvlTree;
+
+    friend bool operator==(const iterator& lhs, const iterator& rhs)
+    {
+      return lhs.m_node == rhs.m_node;
+    }
+
+    friend bool operator!=(const iterator& lhs, const iterator& rhs)
+    {
+      return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const iterator& it)
+    {
+      return os << "IntrusiveAvlTree::iterator{" << it.m_node << '}';
+    }
+
+    iterator() : m_tree{nullptr}, m_node{nullptr}
+    {
+    }
+
+    reference operator*() const
+    {
+      return *static_cast<value_type*>(m_node);
+    }
+
+    pointer operator->() const
+    {
+      return static_cast<value_type*>(m_node);
+    }
+
+    iterator& operator++() // prefix increment
+    {
+      if (m_node == nullptr) {
+        throw std::runtime_error{
+          "IntrusiveAvlTree::iterator: prefix increment called on end "
+          "iterator!"};
+      }
+
+      m_node = algorithms().next(m_node);
+      return *this;
+    }
+
+    iterator operator++(int) // postfix increment
+    {
+      iterator it{*this};
+      ++(*this);
+      return it;
+    }
+
+    iterator& operator--() // prefix decrement
+    {
+      // Decrement end.
+      if (m_node == nullptr) {
+        m_node = algorithms().rightmost(m_tree->m_root);
+        return *this;
+      }
+
+      m_node = algorithms().previous(m_node);
+      return *this;
+    }
+
+    iterator operator--(int) // postfix decrement
+    {
+      iterator it{*this};
+      --(*this);
+      return it;
+    }
+
+  private:
+    iterator(const this_type* tree, AvlHook* node)
+      : m_tree{tree}, m_node{node}
+    {
+    }
+
+    const this_type* m_tree;
+    AvlHook*         m_node;
+  };
+
+  class const_iterator {
+  public:
+    using difference_type   = typename IntrusiveAvlTree::difference_type;
+    using value_type        = typename IntrusiveAvlTree::value_type;
+    using pointer           = const value_type*;
+    using reference         = const value_type&;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using iterator_concept  = std::bidirectional_iterator_tag; // C++20
+
+    friend class IntrusiveAvlTree;
+
+    friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+    {
+      return lhs.m_it == rhs.m_it;
+    }
+
+    friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+    {
+      return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const const_iterator& it)
+    {
+      return os << "IntrusiveAvlTree::const_iterator{" << it.m_it.m_node
+                << '}';
+    }
+
+    const_iterator() : m_it{}
+    {
+    }
+
+    /* IMPLICIT */ const_iterator(iterator it) : m_it{it}
+    {
+    }
+
+    reference operator*() const
+    {
+      return *m_it;
+    }
+
+    pointer operator->() const
+    {
+      return m_it.operator->();
+    }
+
+    const_iterator& operator++() // prefix increment
+    {
+      ++m_it;
+      return *this;
+    }
+
+    const_iterator operator++(int) // postfix increment
+    {
+      const_iterator it{*this};
+      ++(*this);
+      return it;
+    }
+
+    const_iterator& operator--() // prefix decrement
+    {
+      --m_it;
+      return *this;
+    }
+
+    const_iterator operator--(int) // postfix decrement
+    {
+      const_iterator it{*this};
+      --(*this);
+      return it;
+    }
+
+  private:
+    iterator m_it;
+  };
+
+  using reverse_iterator       = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  friend std::ostream& operator<<(std::ostream& os, const this_type& tree)
+  {
+    if (tree.empty()) {
+      return os << "Empty IntrusiveAvlTree";
+    }
+
+    std::ostringstream outputStringStream{};
+    outputStringStream.imbue(std::locale::classic());
+    algorithms().printTree(
+      tree.m_root, 0, outputStringStream, [](std::ostream& os, AvlHook* node) {
+        os << Links{}.key(node);
+      });
+    std::string string{outputStringStream.str()};
+
+    for (int i{0}; i < 5; ++i) {
+      string.pop_back();
+    }
+
+    os << string;
+    return os;
+  }
+
+  IntrusiveAvlTree() : IntrusiveAvlTree{key_compare{}}
+  {
+  }
+
+  explicit IntrusiveAvlTree(const key_compare& compare)
+    : m_root{nullptr}, m_size{0}, m_compare{compare}
+  {
+  }
+
+  IntrusiveAvlTree(const this_type&) = delete;
+
+  IntrusiveAvlTree(this_type&& other) noexcept
+    : m_root{other.m_root}
+    , m_size{other.m_size}
+    , m_compare{std::move(other.m_compare)}
+  {
+    other.m_root = nullptr;
+    other.m_size = 0;
+  }
+
+  this_type& operator=(const this_type&) = delete;
+
+  this_type& operator=(this_type&& other) noexcept
+  {
+    if (this == &other) {
+      return *this;
+    }
+
+    m_root       = other.m_root;
+    m_size       = other.m_size;
+    m_compare    = std::move(other.m_compare);
+    other.m_root = nullptr;
+    other.m_size = 0;
+    return *this;
+  }
+
+  key_compare key_comp() const
+  {
+    return m_compare;
+  }
+
+  size_type size() const
+  {
+    return m_size;
+  }
+
+  [[nodiscard]] bool empty() const
+  {
+    return size() == 0;
+  }
+
+  iterator begin()
+  {
+    if (empty()) {
+      return end();
+    }
+
+    return iterator{this, algorithms().leftmost(m_root)};
+  }
+
+  const_iterator begin() const
+  {
+    return const_iterator{const_cast<this_type*>(this)->begin()};
+  }
+
+  const_iterator cbegin() const
+  {
+    return begin();
+  }
+
+  iterator end()
+  {
+    return iterator{this, nullptr};
+  }
+
+  const_iterator end() const
+  {
+    return const_iterator{const_cast<this_type*>(this)->end()};
+  }
+
+  const_iterator cend() const
+  {
+    return end();
+  }
+
+  reverse_iterator rbegin()
+  {
+    return reverse_iterator{end()};
+  }
+
+  const_reverse_iterator rbegin() const
+  {
+    return const_reverse_iterator{const_cast<this_type*>(this)->rbegin()};
+  }
+
+  const_reverse_iterator crbegin() const
+  {
+    return rbegin();
+  }
+
+  reverse_iterator rend()
+  {
+    return reverse_iterator{begin()};
+  }
+
+  const_reverse_iterator rend() const
+  {
+    return const_cast<this_type*>(this)->rend();
+  }
+
+  const_reverse_iterator crend() const
+  {
+    return rend();
+  }
+
+  /*!
+   * Forgets all elements at once.
+   * Their links are left as they are, inserting an element resets them.
+   */
+  void clear() noexcept
+  {
+    m_root = nullptr;
+    m_size = 0;
+  }
+
+  /*!
+   * Links value into the tree unless an element with an equivalent key is
+   * already present.
+   * Returns an iterator to value or to the element that prevented the
+   * insertion.
+   */
+  std::pair<iterator, bool> insert(reference value) noexcept
+  {
+    AvlHook* const hook{&value};
+    bool           inserted{false};
+    auto           createNode{[hook, &inserted] {
+      hook->setLeft(nullptr);
+      hook->setRight(nullptr);
+      hook->setBalance(0);
+      inserted = true;
+      return hook;
+    }};
+    AvlHook* found{nullptr};
+    m_root = algorithms().insert(
+      m_root, Links{}.key(hook), m_compare, createNode, &found);
+
+    if (inserted) {
+      ++m_size;
+    }
+
+    return {iterator{this, found}, inserted};
+  }
+
+  /*!
+   * Unlinks the element with a key equivalent to key, if any.
+   * Returns an iterator to the element that followed it.
+   */
+  iterator erase(const key_type& key) noexcept
+  {
+    AvlHook* erased{nullptr};
+    AvlHook* next{nullptr};
+    m_root = algorithms().detach(m_root, key, m_compare, &erased, &next);
+
+    if (erased != nullptr) {
+      --m_size;
+    }
+
+    return iterator{this, next};
+  }
+
+  iterator erase(const_iterator pos) noexcept
+  {
+    return erase(Links{}.key(pos.m_it.m_node));
+  }
+
+  void swap(this_type& other) noexcept
+  {
+    using std::swap;
+    swap(m_root, other.m_root);
+    swap(m_size, other.m_size);
+    swap(m_compare, other.m_compare);
+  }
+
+  iterator find(const key_type& key)
+  {
+    AvlHook* node{m_root};
+
+    while (node != nullptr) {
+      const int direction{
+        detail::compareThreeWay(m_compare, key, Links{}.key(node))};
+
+      if (direction < 0) {
+        node = node->left();
+      }
+      else if (direction > 0) {
+        node = node->right();
+      }
+      else {
+        return iterator{this, node};
+      }
+    }
+
+    return end();
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    return const_cast<this_type*>(this)->find(key);
+  }
+
+private:
+  static Algorithms algorithms()
+  {
+    return Algorithms{Links{}};
+  }
+
+  AvlHook*                          m_root;
+  size_type                         m_size;
+  [[no_unique_address]] key_compare m_compare;
+};
+
+template<typename Value, typename KeyOfValue, typename Compare>
+void swap(
+  IntrusiveAvlTree<Value, KeyOfValue, Compare>& lhs,
+  IntrusiveAvlTree<Value, KeyOfValue, Compare>& rhs) noexcept
+{
+  lhs.swap(rhs);
+}
+} // namespace at
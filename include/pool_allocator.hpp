@@ -0,0 +1,385 @@
+#pragma once
+#include <cstddef>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace at {
+namespace detail {
+/*!
+ * Fixed size block pool that carves blocks out of cache line aligned slabs.
+ * Deallocated blocks are kept on an intrusive free list and handed out again
+ * before any new slab is requested from the global allocator.
+ * The block size is fixed by the first call to configure.
+ * Not thread safe.
+ */
+class NodePool {
+public:
+  static constexpr std::size_t cacheLineSize{64};
+  static constexpr std::size_t firstSlabBytes{4096};
+  static constexpr std::size_t maximumSlabBytes{1024 * 1024};
+
+  NodePool()
+    : m_blockSize{0}
+    , m_slabAlignment{cacheLineSize}
+    , m_nextSlabBlockCount{0}
+    , m_freeList{nullptr}
+    , m_freeCount{0}
+    , m_bumpBegin{nullptr}
+    , m_bumpEnd{nullptr}
+    , m_slabs{}
+  {
+  }
+
+  NodePool(const NodePool&) = delete;
+
+  NodePool& operator=(const NodePool&) = delete;
+
+  ~NodePool()
+  {
+    release();
+  }
+
+  bool isConfigured() const
+  {
+    return m_blockSize != 0;
+  }
+
+  bool serves(std::size_t size, std::size_t alignment) const
+  {
+    return m_blockSize == blockSizeFor(size, alignment)
+           && alignment <= m_slabAlignment;
+  }
+
+  void configure(std::size_t size, std::size_t alignment)
+  {
+    m_blockSize          = blockSizeFor(size, alignment);
+    m_slabAlignment
+      = std::max(blockAlignmentFor(alignment), cacheLineSize);
+    m_nextSlabBlockCount
+      = std::max<std::size_t>(1, firstSlabBytes / m_blockSize);
+  }
+
+  void* allocate()
+  {
+    if (m_freeList != nullptr) {
+      FreeBlock* block{m_freeList};
+      m_freeList = block->next;
+      --m_freeCount;
+      return block;
+    }
+
+    if (m_bumpBegin == m_bumpEnd) {
+      addSlab(m_nextSlabBlockCount);
+      m_nextSlabBlockCount = std::min(
+        m_nextSlabBlockCount * 2,
+        std::max<std::size_t>(1, maximumSlabBytes / m_blockSize));
+    }
+
+    void* block{m_bumpBegin};
+    m_bumpBegin += m_blockSize;
+    return block;
+  }
+
+  void deallocate(void* block) noexcept
+  {
+    m_freeList = ::new (block) FreeBlock{m_freeList};
+    ++m_freeCount;
+  }
+
+  /*!
+   * Makes sure that the next blockCount calls to allocate won't need to
+   * allocate a new slab.
+   */
+  void reserve(std::size_t blockCount)
+  {
+    const std::size_t available{
+      m_freeCount
+      + static_cast<std::size_t>(m_bumpEnd - m_bumpBegin) / m_blockSize};
+
+    if (available >= blockCount) {
+      return;
+    }
+
+    addSlab(blockCount - available);
+  }
+
+  /*!
+   * Returns the slabs that contain no live blocks to the global allocator.
+   */
+  void shrinkToFit()
+  {
+    retireBumpRegion();
+
+    std::sort(
+      m_slabs.begin(), m_slabs.end(), [](const Slab& lhs, const Slab& rhs) {
+        return std::less<std::byte*>{}(lhs.memory, rhs.memory);
+      });
+
+    std::vector<std::size_t> freeBlocksPerSlab(m_slabs.size(), 0);
+
+    for (FreeBlock* block{m_freeList}; block != nullptr; block = block->next) {
+      ++freeBlocksPerSlab[slabIndexOf(block)];
+    }
+
+    FreeBlock*  freeList{nullptr};
+    std::size_t freeCount{0};
+
+    for (FreeBlock* block{m_freeList}; block != nullptr;) {
+      FreeBlock*        next{block->next};
+      const std::size_t index{slabIndexOf(block)};
+
+      if (freeBlocksPerSlab[index] != m_slabs[index].blockCount) {
+        block->next = freeList;
+        freeList    = block;
+        ++freeCount;
+      }
+
+      block = next;
+    }
+
+    std::vector<Slab> slabs{};
+
+    for (std::size_t i{0}; i < m_slabs.size(); ++i) {
+      if (freeBlocksPerSlab[i] == m_slabs[i].blockCount) {
+        deallocateSlab(m_slabs[i]);
+      }
+      else {
+        slabs.push_back(m_slabs[i]);
+      }
+    }
+
+    m_slabs.swap(slabs);
+    m_freeList  = freeList;
+    m_freeCount = freeCount;
+  }
+
+  /*!
+   * Returns every slab to the global allocator at once.
+   * Any block handed out previously is invalidated.
+   */
+  void release() noexcept
+  {
+    for (const Slab& slab : m_slabs) {
+      deallocateSlab(slab);
+    }
+
+    m_slabs.clear();
+    m_freeList  = nullptr;
+    m_freeCount = 0;
+    m_bumpBegin = nullptr;
+    m_bumpEnd   = nullptr;
+  }
+
+private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct Slab {
+    std::byte*  memory;
+    std::size_t blockCount;
+  };
+
+  // Every block holds a FreeBlock while it's on the free list.
+  static std::size_t blockAlignmentFor(std::size_t alignment)
+  {
+    return std::max(alignment, alignof(FreeBlock));
+  }
+
+  // Rounds up so that consecutive blocks in a slab stay aligned.
+  static std::size_t blockSizeFor(std::size_t size, std::size_t alignment)
+  {
+    const std::size_t blockAlignment{blockAlignmentFor(alignment)};
+    const std::size_t blockSize{std::max(size, sizeof(FreeBlock))};
+    return (blockSize + blockAlignment - 1) / blockAlignment * blockAlignment;
+  }
+
+  void addSlab(std::size_t blockCount)
+  {
+    // Makes room before the slab exists, so that a failure leaks nothing,
+    // growing geometrically like push_back would.
+    if (m_slabs.size() == m_slabs.capacity()) {
+      m_slabs.reserve(std::max<std::size_t>(4, 2 * m_slabs.capacity()));
+    }
+
+    auto* memory{static_cast<std::byte*>(::operator new(
+      blockCount * m_blockSize, std::align_val_t{m_slabAlignment}))};
+    m_slabs.push_back(Slab{memory, blockCount});
+
+    retireBumpRegion();
+    m_bumpBegin = memory;
+    m_bumpEnd   = memory + blockCount * m_blockSize;
+  }
+
+  void deallocateSlab(const Slab& slab) noexcept
+  {
+    ::operator delete(slab.memory, std::align_val_t{m_slabAlignment});
+  }
+
+  void retireBumpRegion() noexcept
+  {
+    while (m_bumpBegin != m_bumpEnd) {
+      deallocate(m_bumpBegin);
+      m_bumpBegin += m_blockSize;
+    }
+
+    m_bumpBegin = nullptr;
+    m_bumpEnd   = nullptr;
+  }
+
+  // Requires m_slabs to be sorted by address.
+  std::size_t slabIndexOf(FreeBlock* block) const
+  {
+    auto* address{reinterpret_cast<std::byte*>(block)};
+    auto  it{std::upper_bound(
+      m_slabs.begin(),
+      m_slabs.end(),
+      address,
+      [](std::byte* addr, const Slab& slab) {
+        return std::less<std::byte*>{}(addr, slab.memory);
+      })};
+    return static_cast<std::size_t>(it - m_slabs.begin()) - 1;
+  }
+
+  std::size_t       m_blockSize;
+  std::size_t       m_slabAlignment;
+  std::size_t       m_nextSlabBlockCount;
+  FreeBlock*        m_freeList;
+  std::size_t       m_freeCount;
+  std::byte*        m_bumpBegin;
+  std::byte*        m_bumpEnd;
+  std::vector<Slab> m_slabs;
+};
+} // namespace detail
+
+/*!
+ * Allocator that serves single object allocations from a NodePool.
+ * Meant to be used as the Allocator of an AvlTree:
+ * every default constructed PoolAllocator owns a fresh pool, copies share it.
+ * Copy constructing a container gives the copy a pool of its own,
+ * moving and swapping containers moves the pool along with the nodes.
+ * Allocations the pool can't serve (arrays or differently sized types)
+ * are forwarded to std::allocator.
+ */
+template<typename Ty>
+class PoolAllocator {
+public:
+  using value_type                             = Ty;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap            = std::true_type;
+  using is_always_equal                        = std::false_type;
+
+  template<typename Other>
+  friend class PoolAllocator;
+
+  PoolAllocator() : m_pool{std::make_shared<detail::NodePool>()}
+  {
+  }
+
+  template<typename Other>
+  PoolAllocator(const PoolAllocator<Other>& other) noexcept
+    : m_pool{other.m_pool}
+  {
+  }
+
+  PoolAllocator select_on_container_copy_construction() const
+  {
+    return PoolAllocator{};
+  }
+
+  Ty* allocate(std::size_t count)
+  {
+    if (count == 1 && isPooled()) {
+      return static_cast<Ty*>(pool().allocate());
+    }
+
+    return std::allocator<Ty>{}.allocate(count);
+  }
+
+  void deallocate(Ty* pointer, std::size_t count) noexcept
+  {
+    if (count == 1 && m_pool != nullptr
+        && m_pool->serves(sizeof(Ty), alignof(Ty))) {
+      m_pool->deallocate(pointer);
+      return;
+    }
+
+    std::allocator<Ty>{}.deallocate(pointer, count);
+  }
+
+  void reserve(std::size_t count)
+  {
+    if (isPooled()) {
+      pool().reserve(count);
+    }
+  }
+
+  void shrink_to_fit()
+  {
+    if (m_pool != nullptr) {
+      m_pool->shrinkToFit();
+    }
+  }
+
+  /*!
+   * Returns all storage of the pool at once, in O(number of slabs),
+   * if no other allocator shares the pool.
+   * Every block handed out by the pool is invalidated without running
+   * any destructor.
+   * Returns whether the storage was released.
+   */
+  bool release() noexcept
+  {
+    if (m_pool == nullptr || m_pool.use_count() != 1) {
+      return false;
+    }
+
+    m_pool->release();
+    return true;
+  }
+
+  /*!
+   * Returns the number of allocators that share the pool.
+   */
+  long use_count() const noexcept
+  {
+    return m_pool.use_count();
+  }
+
+  template<typename Other>
+  friend bool operator==(
+    const PoolAllocator&        lhs,
+    const PoolAllocator<Other>& rhs) noexcept
+  {
+    return lhs.m_pool == rhs.m_pool;
+  }
+
+private:
+  // A moved from allocator starts over with a pool of its own.
+  detail::NodePool& pool()
+  {
+    if (m_pool == nullptr) {
+      m_pool = std::make_shared<detail::NodePool>();
+    }
+
+    if (!m_pool->isConfigured()) {
+      m_pool->configure(sizeof(Ty), alignof(Ty));
+    }
+
+    return *m_pool;
+  }
+
+  bool isPooled()
+  {
+    return pool().serves(sizeof(Ty), alignof(Ty));
+  }
+
+  std::shared_ptr<detail::NodePool> m_pool;
+};
+} // namespace at
@@ -0,0 +1,129 @@
+#pragma once
+#include <cstddef>
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace at {
+/*!
+ * Destroys detached trees on a background thread, so that dropping a large
+ * tree doesn't stall the thread that owned it.
+ * Work is done in slices of at most sliceNodeCount nodes, pending jobs take
+ * turns after every slice.
+ * The destructor finishes all pending work before it returns.
+ */
+class TreeReclaimer {
+public:
+  /*!
+   * Destroys at most the given number of nodes per call,
+   * returns whether there is nothing left to destroy.
+   */
+  using Job = std::function<bool(std::size_t)>;
+
+  static constexpr std::size_t sliceNodeCount{4096};
+
+  TreeReclaimer()
+    : m_mutex{}
+    , m_workAvailable{}
+    , m_idle{}
+    , m_jobs{}
+    , m_runningJobs{0}
+    , m_stopping{false}
+    , m_thread{[this] { run(); }}
+  {
+  }
+
+  TreeReclaimer(const TreeReclaimer&) = delete;
+
+  TreeReclaimer& operator=(const TreeReclaimer&) = delete;
+
+  ~TreeReclaimer()
+  {
+    {
+      const std::lock_guard<std::mutex> lock{m_mutex};
+      m_stopping = true;
+    }
+
+    m_workAvailable.notify_one();
+    m_thread.join();
+  }
+
+  /*!
+   * The reclaimer used if none is given, started on first use.
+   */
+  static TreeReclaimer& global()
+  {
+    static TreeReclaimer reclaimer{};
+    return reclaimer;
+  }
+
+  void post(Job job)
+  {
+    {
+      const std::lock_guard<std::mutex> lock{m_mutex};
+      m_jobs.push_back(std::move(job));
+    }
+
+    m_workAvailable.notify_one();
+  }
+
+  /*!
+   * Blocks until every job posted so far is done.
+   */
+  void wait_idle()
+  {
+    std::unique_lock<std::mutex> lock{m_mutex};
+    m_idle.wait(lock, [this] { return m_jobs.empty() && m_runningJobs == 0; });
+  }
+
+private:
+  void run()
+  {
+    std::unique_lock<std::mutex> lock{m_mutex};
+
+    for (;;) {
+      m_workAvailable.wait(
+        lock, [this] { return m_stopping || !m_jobs.empty(); });
+
+      if (m_jobs.empty()) {
+        return;
+      }
+
+      // Jobs are moved between lists by splicing, which can't throw.
+      std::list<Job> current{};
+      current.splice(current.end(), m_jobs, m_jobs.begin());
+      ++m_runningJobs;
+
+      lock.unlock();
+      const bool done{current.front()(sliceNodeCount)};
+      lock.lock();
+
+      --m_runningJobs;
+
+      if (!done) {
+        m_jobs.splice(m_jobs.end(), current);
+        continue;
+      }
+
+      // Whatever the job holds on to goes before anyone is told it's done.
+      current.clear();
+
+      if (m_jobs.empty()) {
+        m_idle.notify_all();
+      }
+    }
+  }
+
+  std::mutex              m_mutex;
+  std::condition_variable m_workAvailable;
+  std::condition_variable m_idle;
+  std::list<Job>          m_jobs;
+  std::size_t             m_runningJobs;
+  bool                    m_stopping;
+  std::thread             m_thread;
+};
+} // namespace at
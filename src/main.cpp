@@ -6,18 +6,30 @@
 
 #include <cctype>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 
 #include <algorithm>
 #include <array>
+#include <compare>
+#include <iterator>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <random>
+#include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "test_framework.hpp"
 
+#include "array_avl_tree.hpp"
+#include "avl_interval_tree.hpp"
 #include "avl_tree.hpp"
+#include "intrusive_avl_tree.hpp"
+#include "pool_allocator.hpp"
+#include "tree_reclaimer.hpp"
 
 using namespace std::string_literals;
 
@@ -65,6 +77,352 @@ static std::mt19937_64 createURBG()
   return std::mt19937_64{seedSequence};
 }
 
+template<typename Ty>
+class CountingAllocator {
+public:
+  using value_type                             = Ty;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap            = std::true_type;
+
+  template<typename Other>
+  friend class CountingAllocator;
+
+  CountingAllocator(int id, std::size_t* liveAllocations)
+    : m_id{id}, m_liveAllocations{liveAllocations}
+  {
+  }
+
+  template<typename Other>
+  CountingAllocator(const CountingAllocator<Other>& other)
+    : m_id{other.m_id}, m_liveAllocations{other.m_liveAllocations}
+  {
+  }
+
+  Ty* allocate(std::size_t count)
+  {
+    ++*m_liveAllocations;
+    return std::allocator<Ty>{}.allocate(count);
+  }
+
+  void deallocate(Ty* pointer, std::size_t count)
+  {
+    --*m_liveAllocations;
+    std::allocator<Ty>{}.deallocate(pointer, count);
+  }
+
+  int id() const
+  {
+    return m_id;
+  }
+
+  template<typename Other>
+  friend bool operator==(
+    const CountingAllocator&        lhs,
+    const CountingAllocator<Other>& rhs)
+  {
+    return lhs.m_id == rhs.m_id;
+  }
+
+private:
+  int          m_id;
+  std::size_t* m_liveAllocations;
+};
+
+using CountingTree
+  = at::AvlTree<int, int, std::less<int>, CountingAllocator<int>>;
+
+using PoolTree = at::AvlTree<
+  int,
+  int,
+  std::less<int>,
+  at::PoolAllocator<std::pair<const int, int>>>;
+
+struct WithoutParentLinks : at::AvlTreeTraits {
+  static constexpr bool parentLinks{false};
+};
+
+using ParentlessTree = at::AvlTree<
+  int,
+  int,
+  std::less<int>,
+  std::allocator<std::pair<const int, int>>,
+  WithoutParentLinks>;
+
+using ArrayTree = at::ArrayAvlTree<int, int>;
+
+struct Item : at::AvlHook {
+  Item(int key, std::string name) : key{key}, name{std::move(name)}
+  {
+  }
+
+  int         key;
+  std::string name;
+};
+
+struct KeyOfItem {
+  const int& operator()(const Item& item) const
+  {
+    return item.key;
+  }
+};
+
+using IntrusiveTree = at::IntrusiveAvlTree<Item, KeyOfItem>;
+
+using Set = at::AvlSet<int>;
+
+using Multimap = at::AvlMultimap<int, int>;
+
+// Only compares string_views, looking up a std::string_view in a tree of
+// std::strings therefore doesn't create a std::string.
+struct StringViewLess {
+  using is_transparent = void;
+
+  bool operator()(std::string_view lhs, std::string_view rhs) const
+  {
+    return lhs < rhs;
+  }
+};
+
+using StringTree = at::AvlTree<std::string, int, StringViewLess>;
+
+// Sort order picked at runtime.
+class DirectedLess {
+public:
+  explicit DirectedLess(bool descending = false) : m_descending{descending}
+  {
+  }
+
+  bool operator()(int lhs, int rhs) const
+  {
+    return m_descending ? rhs < lhs : lhs < rhs;
+  }
+
+private:
+  bool m_descending;
+};
+
+using DirectedTree = at::AvlTree<int, int, DirectedLess>;
+
+// Counts how often it is called as a less than comparison and as a
+// three-way comparison.
+struct CountingCompare3 {
+  bool operator()(int lhs, int rhs) const
+  {
+    ++*lessCount;
+    return lhs < rhs;
+  }
+
+  std::strong_ordering compare3(int lhs, int rhs) const
+  {
+    ++*compare3Count;
+    return lhs <=> rhs;
+  }
+
+  std::size_t* lessCount;
+  std::size_t* compare3Count;
+};
+
+// Key whose std::less orders the other way round than its <=>.
+struct ReversedKey {
+  int value;
+
+  auto operator<=>(const ReversedKey&) const = default;
+};
+
+template<>
+struct std::less<ReversedKey> {
+  bool operator()(const ReversedKey& lhs, const ReversedKey& rhs) const
+  {
+    return rhs.value < lhs.value;
+  }
+};
+
+using ParentlessMultimap = at::AvlMultimap<
+  int,
+  int,
+  std::less<int>,
+  std::allocator<std::pair<const int, int>>,
+  WithoutParentLinks>;
+
+struct WithOrderStatistics : at::AvlTreeTraits {
+  static constexpr bool orderStatistics{true};
+};
+
+struct ParentlessWithOrderStatistics : WithoutParentLinks {
+  static constexpr bool orderStatistics{true};
+};
+
+using RankedTree = at::AvlTree<
+  int,
+  int,
+  std::less<int>,
+  std::allocator<std::pair<const int, int>>,
+  WithOrderStatistics>;
+
+using ParentlessRankedMultimap = at::AvlMultimap<
+  int,
+  int,
+  std::less<int>,
+  std::allocator<std::pair<const int, int>>,
+  ParentlessWithOrderStatistics>;
+
+struct SumOfValues {
+  using value_type = long long;
+
+  static value_type identity()
+  {
+    return 0;
+  }
+
+  static value_type of(const std::pair<const int, int>& element)
+  {
+    return element.second;
+  }
+
+  static value_type combine(value_type lhs, value_type rhs)
+  {
+    return lhs + rhs;
+  }
+};
+
+struct WithSumOfValues : at::AvlTreeTraits {
+  using Aggregate = SumOfValues;
+};
+
+struct ParentlessWithSumOfValues : WithoutParentLinks {
+  using Aggregate = SumOfValues;
+};
+
+using SummingTree = at::AvlTree<
+  int,
+  int,
+  std::less<int>,
+  std::allocator<std::pair<const int, int>>,
+  WithSumOfValues>;
+
+using ParentlessSummingMultimap = at::AvlMultimap<
+  int,
+  int,
+  std::less<int>,
+  std::allocator<std::pair<const int, int>>,
+  ParentlessWithSumOfValues>;
+
+// Not commutative, shows the order in which aggregates are combined.
+struct Concatenation {
+  using value_type = std::string;
+
+  static value_type identity()
+  {
+    return {};
+  }
+
+  static value_type of(const std::string& element)
+  {
+    return element;
+  }
+
+  static value_type combine(const value_type& lhs, const value_type& rhs)
+  {
+    return lhs + rhs;
+  }
+};
+
+struct WithConcatenation : at::AvlTreeTraits {
+  using Aggregate = Concatenation;
+};
+
+using ConcatenatingSet = at::AvlSet<
+  std::string,
+  std::less<std::string>,
+  std::allocator<std::string>,
+  WithConcatenation>;
+
+// The sum and the number of the values.
+struct SumAndCount {
+  using value_type = std::pair<long long, long long>;
+
+  static value_type identity()
+  {
+    return {0, 0};
+  }
+
+  static value_type of(const std::pair<const int, int>& element)
+  {
+    return {element.second, 1};
+  }
+
+  static value_type combine(const value_type& lhs, const value_type& rhs)
+  {
+    return {lhs.first + rhs.first, lhs.second + rhs.second};
+  }
+};
+
+// value -> factor * value + offset, composing these is not commutative.
+struct AffineChange {
+  int factor;
+  int offset;
+};
+
+struct ApplyAffineChange {
+  using value_type = AffineChange;
+
+  static void apply(const AffineChange& change, int& mapped)
+  {
+    mapped = change.factor * mapped + change.offset;
+  }
+
+  static AffineChange compose(
+    const AffineChange& first,
+    const AffineChange& second)
+  {
+    return {
+      second.factor * first.factor,
+      second.factor * first.offset + second.offset};
+  }
+
+  static void applyToAggregate(
+    const AffineChange&      change,
+    SumAndCount::value_type& aggregate)
+  {
+    aggregate.first = change.factor * aggregate.first
+                      + change.offset * aggregate.second;
+  }
+};
+
+struct WithAffineChanges : at::AvlTreeTraits {
+  using Aggregate   = SumAndCount;
+  using RangeUpdate = ApplyAffineChange;
+};
+
+struct ParentlessWithAffineChanges : WithoutParentLinks {
+  static constexpr bool orderStatistics{true};
+  using Aggregate   = SumAndCount;
+  using RangeUpdate = ApplyAffineChange;
+};
+
+using AffineTree = at::AvlTree<
+  int,
+  int,
+  std::less<int>,
+  std::allocator<std::pair<const int, int>>,
+  WithAffineChanges>;
+
+using ParentlessAffineMultimap = at::AvlMultimap<
+  int,
+  int,
+  std::less<int>,
+  std::allocator<std::pair<const int, int>>,
+  ParentlessWithAffineChanges>;
+
+using IntervalTree = at::AvlIntervalTree<at::Interval<int>, int>;
+
+using ParentlessIntervalTree = at::AvlIntervalTree<
+  at::Interval<int>,
+  int,
+  std::allocator<std::pair<const at::Interval<int>, int>>,
+  WithoutParentLinks>;
+
 AT_TEST(shouldBeAbleToDefaultConstruct)
 {
   Tree t{};
@@ -141,14 +499,15 @@ AT_TEST(shouldBeAbleToConstructFromInitializerList)
   AT_ASSERT_EQ(40, it->first);
   AT_ASSERT_EQ(20, it->second);
 
+  // Sorted input is built perfectly balanced.
   const std::string expectedTreeString{trimmed(R"(
 |=====4 => 2
 |
 |
-8 => 4
+|===========8 => 4
 |
 |
-|===========16 => 8
+16 => 8
 |
 |
 |=====20 => 10
@@ -159,6 +518,80 @@ AT_TEST(shouldBeAbleToConstructFromInitializerList)
   AT_ASSERT_EQ(expectedTreeString, at::toString(t));
 }
 
+AT_TEST(shouldBuildTreeFromSortedRangeWithoutRotations)
+{
+  std::size_t                      liveAllocations{0};
+  std::vector<std::pair<int, int>> sorted{};
+
+  for (int i{1}; i <= 7; ++i) {
+    sorted.emplace_back(i, i);
+  }
+
+  const CountingTree t{
+    at::sorted_unique,
+    sorted.begin(),
+    sorted.end(),
+    CountingAllocator<int>{1, &liveAllocations}};
+
+  const std::string expected{trimmed(R"(
+|===========1 => 1
+|
+|
+|=====2 => 2
+|
+|
+|===========3 => 3
+|
+|
+4 => 4
+|
+|
+|===========5 => 5
+|
+|
+|=====6 => 6
+|
+|
+|===========7 => 7)")};
+
+  AT_ASSERT_EQ(expected, at::toString(t));
+  AT_ASSERT_EQ(7U, t.size());
+  AT_ASSERT_EQ(7, liveAllocations);
+  AT_ASSERT_EQ(7, std::prev(t.end())->first);
+}
+
+AT_TEST(shouldDetectSortedRanges)
+{
+  const std::vector<std::pair<int, int>> sorted{
+    {1, 1}, {2, 2}, {2, 3}, {3, 4}, {4, 5}, {4, 6}, {5, 7}};
+  const Tree fromSorted{sorted.begin(), sorted.end()};
+
+  // Equivalent keys keep their first element, as with repeated insert.
+  const std::string expected{trimmed(R"(
+|=====1 => 1
+|
+|
+|===========2 => 2
+|
+|
+3 => 4
+|
+|
+|=====4 => 5
+|
+|
+|===========5 => 7)")};
+  AT_ASSERT_EQ(expected, at::toString(fromSorted));
+
+  const std::vector<std::pair<int, int>> unsorted{{3, 3}, {1, 1}, {2, 2}};
+  Tree                                   fromUnsorted{
+    unsorted.begin(), unsorted.end()};
+  fromUnsorted.insert(sorted.begin(), sorted.end());
+  AT_ASSERT_EQ(5U, fromUnsorted.size());
+  AT_ASSERT_EQ(3, fromUnsorted.find(3)->second);
+  AT_ASSERT_EQ(5, fromUnsorted.find(4)->second);
+}
+
 AT_TEST(shouldBeAbleToCopyConstruct)
 {
   const Tree t{testTree()};
@@ -202,6 +635,46 @@ AT_TEST(shouldBeAbleToCopyAssign)
   }
 }
 
+AT_TEST(shouldCopyTheShapeOfTheSource)
+{
+  Tree t{};
+
+  for (int i{0}; i < 200; ++i) {
+    t.insert((i * 17) % 200, i);
+  }
+
+  for (int i{0}; i < 200; i += 3) {
+    t.erase(i);
+  }
+
+  Tree           copy{t};
+  ParentlessTree parentless{};
+
+  for (const auto& [key, value] : t) {
+    parentless.insert(key, value);
+  }
+
+  const ParentlessTree parentlessCopy{parentless};
+
+  AT_ASSERT_EQ(at::toString(t), at::toString(copy));
+  AT_ASSERT_EQ(at::toString(parentless), at::toString(parentlessCopy));
+  AT_ASSERT_EQ(
+    true, std::equal(t.rbegin(), t.rend(), copy.rbegin(), copy.rend()));
+
+  // The balance factors are copied as well, so both rebalance alike.
+  for (int i{200}; i < 300; ++i) {
+    t.insert(i, i);
+    copy.insert(i, i);
+  }
+
+  for (int i{1}; i < 300; i += 4) {
+    t.erase(i);
+    copy.erase(i);
+  }
+
+  AT_ASSERT_EQ(at::toString(t), at::toString(copy));
+}
+
 AT_TEST(shouldBeAbleToAssignWithInitializerList)
 {
   Tree t{testTree()};
@@ -399,6 +872,125 @@ AT_TEST(shouldBeAbleToAssignWithInsertOrAssign)
   AT_ASSERT_EQ(500, it->second);
 }
 
+AT_TEST(shouldBeAbleToMoveConstruct)
+{
+  Tree       t1{testTree()};
+  const Tree t2{std::move(t1)};
+
+  AT_ASSERT_EQ(10, t2.size());
+  AT_ASSERT_EQ(true, t1.empty());
+
+  for (int i{1}; i <= 10; ++i) {
+    AT_ASSERT_NE(t2.end(), t2.find(i));
+  }
+}
+
+AT_TEST(shouldBeAbleToMoveAssign)
+{
+  Tree t1{testTree()};
+  Tree t2{{1, 2}, {3, 4}};
+
+  t2 = std::move(t1);
+
+  AT_ASSERT_EQ(10, t2.size());
+  AT_ASSERT_EQ(true, t1.empty());
+  AT_ASSERT_EQ(1, t2.find(1)->second);
+  AT_ASSERT_EQ(t2.end(), t2.find(11));
+}
+
+AT_TEST(shouldBeAbleToEmplace)
+{
+  at::AvlTree<std::string, std::string> t{};
+  const auto [it, wasInserted] = t.emplace("key", std::string(3, 'x'));
+  AT_ASSERT_EQ(true, wasInserted);
+  AT_ASSERT_EQ("key"s, it->first);
+  AT_ASSERT_EQ("xxx"s, it->second);
+
+  const auto [it2, wasInserted2] = t.emplace("key", "other");
+  AT_ASSERT_EQ(false, wasInserted2);
+  AT_ASSERT_EQ(it, it2);
+  AT_ASSERT_EQ("xxx"s, it2->second);
+  AT_ASSERT_EQ(1, t.size());
+}
+
+AT_TEST(shouldBeAbleToTryEmplace)
+{
+  at::AvlTree<int, std::unique_ptr<int>> t{};
+  std::unique_ptr<int> first{std::make_unique<int>(1)};
+  std::unique_ptr<int> second{std::make_unique<int>(2)};
+
+  const auto [it, wasInserted] = t.try_emplace(1, std::move(first));
+  AT_ASSERT_EQ(true, wasInserted);
+  AT_ASSERT_EQ(1, *it->second);
+  AT_ASSERT_EQ(true, first == nullptr);
+
+  const auto [it2, wasInserted2] = t.try_emplace(1, std::move(second));
+  AT_ASSERT_EQ(false, wasInserted2);
+  AT_ASSERT_EQ(it, it2);
+  AT_ASSERT_EQ(1, *it2->second);
+  AT_ASSERT_EQ(2, *second);
+}
+
+AT_TEST(shouldNotCreateANodeWhenInsertingAPresentKey)
+{
+  at::AvlTree<int, std::unique_ptr<int>> t{};
+  t.try_emplace(1, std::make_unique<int>(1));
+
+  // The element is only moved from if its node is created.
+  std::pair<int, std::unique_ptr<int>> pair{1, std::make_unique<int>(2)};
+  AT_ASSERT_EQ(false, t.insert(std::move(pair)).second);
+  AT_ASSERT_EQ(2, *pair.second);
+
+  std::pair<const int, std::unique_ptr<int>> element{
+    1, std::make_unique<int>(3)};
+  AT_ASSERT_EQ(false, t.insert(std::move(element)).second);
+  AT_ASSERT_EQ(3, *element.second);
+  AT_ASSERT_EQ(1, *t.find(1)->second);
+
+  pair.first = 2;
+  AT_ASSERT_EQ(true, t.insert(std::move(pair)).second);
+  AT_ASSERT_EQ(true, pair.second == nullptr);
+  AT_ASSERT_EQ(2, *t.find(2)->second);
+  AT_ASSERT_EQ(2, t.size());
+}
+
+AT_TEST(shouldSupportMoveOnlyMappedTypes)
+{
+  at::AvlTree<int, std::unique_ptr<int>> t1{};
+
+  for (int i{1}; i <= 10; ++i) {
+    t1.insert(i, std::make_unique<int>(i));
+  }
+
+  t1.insert_or_assign(5, std::make_unique<int>(50));
+  t1.insert_or_assign(11, std::make_unique<int>(11));
+  t1.erase(3);
+
+  at::AvlTree<int, std::unique_ptr<int>> t2{};
+  t2 = std::move(t1);
+
+  AT_ASSERT_EQ(10, t2.size());
+  AT_ASSERT_EQ(50, *t2.find(5)->second);
+  AT_ASSERT_EQ(11, *t2.find(11)->second);
+  AT_ASSERT_EQ(t2.end(), t2.find(3));
+}
+
+AT_TEST(shouldMoveValuesIntoTheTree)
+{
+  at::AvlTree<std::string, std::string> t{};
+  std::string key(100, 'k');
+  std::string value(100, 'v');
+
+  t.insert(std::move(key), std::move(value));
+  AT_ASSERT_EQ(true, key.empty());
+  AT_ASSERT_EQ(true, value.empty());
+
+  std::string newValue(100, 'n');
+  t.insert_or_assign(std::string(100, 'k'), std::move(newValue));
+  AT_ASSERT_EQ(true, newValue.empty());
+  AT_ASSERT_EQ(std::string(100, 'n'), t.find(std::string(100, 'k'))->second);
+}
+
 AT_TEST(shouldBeAbleToErase)
 {
   Tree           t{testTree()};
@@ -476,6 +1068,47 @@ AT_TEST(shouldBeAbleToEraseLastElement)
   AT_ASSERT_EQ(expected, actual);
 }
 
+AT_TEST(shouldKeepParentLinksWhenErasingNodesWithTwoChildren)
+{
+  Tree          t{};
+  std::set<int> expected{};
+
+  for (int i{1}; i <= 31; ++i) {
+    t.insert(i, i);
+    expected.insert(i);
+  }
+
+  // The root and inner nodes all have two children, so their successors
+  // take their place.
+  for (int key : {16, 8, 24, 4, 12, 20, 28, 17}) {
+    const Tree::iterator it{t.erase(key)};
+    expected.erase(key);
+    AT_ASSERT_EQ(*expected.upper_bound(key), it->first);
+
+    // Walking from every node climbs along the parent links.
+    for (int remaining : expected) {
+      const Tree::iterator from{t.find(remaining)};
+      AT_ASSERT_EQ(
+        std::distance(expected.find(remaining), expected.end()),
+        std::distance(from, t.end()));
+      AT_ASSERT_EQ(
+        std::distance(expected.begin(), expected.find(remaining)),
+        std::distance(t.begin(), from));
+    }
+
+    AT_ASSERT_EQ(
+      true,
+      std::equal(
+        expected.rbegin(),
+        expected.rend(),
+        t.rbegin(),
+        t.rend(),
+        [](int lhs, const auto& rhs) { return lhs == rhs.first; }));
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+}
+
 AT_TEST(shouldDoNothingWhenErasingNonExistantKey)
 {
   Tree                 t{testTree()};
@@ -552,76 +1185,436 @@ AT_TEST(shouldBeAbleToSwap)
   }
 }
 
-AT_TEST(shouldBeAbleToFindByKey)
+AT_TEST(shouldAllocateNodesThroughTheAllocator)
 {
-  const Tree           t{testTree()};
-  Tree::const_iterator p{t.find(4)};
-  AT_ASSERT_NE(t.end(), p);
-  AT_ASSERT_EQ(4, p->second);
-}
+  std::size_t liveAllocations{0};
 
-AT_TEST(shouldNotBeAbleToFindNonExistantKey)
-{
-  const Tree           t{testTree()};
-  Tree::const_iterator p{t.find(11)};
-  AT_ASSERT_EQ(t.end(), p);
+  {
+    CountingTree t{CountingAllocator<int>{1, &liveAllocations}};
+
+    for (int i{1}; i <= 10; ++i) {
+      t.insert(i, i);
+    }
+
+    AT_ASSERT_EQ(10, liveAllocations);
+    t.erase(5);
+    AT_ASSERT_EQ(9, liveAllocations);
+    t.clear();
+    AT_ASSERT_EQ(0, liveAllocations);
+    t.insert(1, 1);
+    AT_ASSERT_EQ(1, liveAllocations);
+  }
+
+  AT_ASSERT_EQ(0, liveAllocations);
 }
 
-AT_TEST(shouldBeAbleToIterateForwardUsingIterators)
+AT_TEST(shouldMoveNodesBetweenTreesWithoutAllocating)
 {
-  Tree t{testTree()};
-
-  int i{1};
+  std::size_t            liveAllocations{0};
+  CountingAllocator<int> allocator{1, &liveAllocations};
+  CountingTree           source{allocator};
+  CountingTree           destination{allocator};
 
-  for (Tree::iterator it{t.begin()}, end{t.end()}; it != end; ++it, ++i) {
-    AT_ASSERT_EQ(i, it->first);
-    AT_ASSERT_EQ(i, it->second);
+  for (int i{1}; i <= 10; ++i) {
+    source.insert(i, i * 10);
   }
+
+  AT_ASSERT_EQ(10, liveAllocations);
+
+  CountingTree::node_type node{source.extract(4)};
+  AT_ASSERT_EQ(false, node.empty());
+  AT_ASSERT_EQ(4, node.key());
+  AT_ASSERT_EQ(40, node.mapped());
+  AT_ASSERT_EQ(9U, source.size());
+  AT_ASSERT_EQ(true, source.find(4) == source.end());
+
+  const auto result{destination.insert(std::move(node))};
+  AT_ASSERT_EQ(true, result.inserted);
+  AT_ASSERT_EQ(true, result.node.empty());
+  AT_ASSERT_EQ(4, result.position->first);
+  AT_ASSERT_EQ(40, destination.find(4)->second);
+
+  node = source.extract(source.find(5));
+  AT_ASSERT_EQ(5, node.key());
+  AT_ASSERT_EQ(10, liveAllocations);
+
+  // Assigning to a node handle destroys the node it owned.
+  node = source.extract(42);
+  AT_ASSERT_EQ(true, node.empty());
+  AT_ASSERT_EQ(9, liveAllocations);
+
+  source.clear();
+  AT_ASSERT_EQ(1, liveAllocations);
 }
 
-AT_TEST(shouldBeAbleToPostfixIncrementIterateForwardUsingIterators)
+AT_TEST(shouldBeAbleToChangeTheKeyOfAnExtractedNode)
 {
   Tree t{testTree()};
 
-  int i{1};
+  Tree::node_type node{t.extract(3)};
+  node.key() = 42;
+  AT_ASSERT_EQ(true, t.insert(std::move(node)).inserted);
+  AT_ASSERT_EQ(3, t.find(42)->second);
+  AT_ASSERT_EQ(42, std::prev(t.end())->first);
+
+  node        = t.extract(42);
+  node.key()  = 5;
+  auto result = t.insert(std::move(node));
+  AT_ASSERT_EQ(false, result.inserted);
+  AT_ASSERT_EQ(5, result.position->first);
+  AT_ASSERT_EQ(5, result.node.key());
+  AT_ASSERT_EQ(3, result.node.mapped());
+  AT_ASSERT_EQ(9U, t.size());
+
+  std::size_t  liveAllocations{0};
+  CountingTree other{CountingAllocator<int>{2, &liveAllocations}};
+  CountingTree source{CountingAllocator<int>{3, &liveAllocations}};
+  source.insert(1, 1);
 
-  for (Tree::iterator it{t.begin()}, end{t.end()}; it != end; it++, ++i) {
-    AT_ASSERT_EQ(i, it->first);
-    AT_ASSERT_EQ(i, it->second);
+  try {
+    other.insert(source.extract(1));
+    AT_ASSERT_EQ(false, true);
   }
+  catch (const std::invalid_argument& ex) {
+    AT_ASSERT_EQ(
+      "AvlTree::insert: node handle with an unequal allocator!"s, ex.what());
+  }
+
+  AT_ASSERT_EQ(0, liveAllocations);
 }
 
-AT_TEST(shouldBeAbleToIterateForwardUsingConstIterators)
+AT_TEST(shouldPropagateAllocatorOnCopyAssignment)
 {
-  const Tree t{testTree()};
+  std::size_t  liveAllocations{0};
+  CountingTree t1{CountingAllocator<int>{1, &liveAllocations}};
+  CountingTree t2{CountingAllocator<int>{2, &liveAllocations}};
+  t1.insert(1, 1);
+  t2.insert(2, 2);
 
-  int i{1};
+  t2 = t1;
 
-  for (Tree::const_iterator it{t.begin()}, end{t.end()}; it != end; ++it, ++i) {
-    AT_ASSERT_EQ(i, it->first);
-    AT_ASSERT_EQ(i, it->second);
-  }
+  AT_ASSERT_EQ(1, t2.get_allocator().id());
+  AT_ASSERT_EQ(2, liveAllocations);
+  AT_ASSERT_NE(t2.end(), t2.find(1));
+  AT_ASSERT_EQ(t2.end(), t2.find(2));
 }
 
-AT_TEST(shouldBeAbleToPostfixIncrementIterateForwardUsingConstIterators)
+AT_TEST(shouldPropagateAllocatorOnMove)
 {
-  const Tree t{testTree()};
+  std::size_t  liveAllocations{0};
+  CountingTree t1{CountingAllocator<int>{1, &liveAllocations}};
+  t1.insert(1, 1);
+  t1.insert(2, 2);
+
+  CountingTree t2{std::move(t1)};
+  AT_ASSERT_EQ(1, t2.get_allocator().id());
+  AT_ASSERT_EQ(2, t2.size());
+  AT_ASSERT_EQ(2, liveAllocations);
+
+  CountingTree t3{CountingAllocator<int>{3, &liveAllocations}};
+  t3.insert(3, 3);
+  t3 = std::move(t2);
+  AT_ASSERT_EQ(1, t3.get_allocator().id());
+  AT_ASSERT_EQ(2, t3.size());
+  AT_ASSERT_EQ(2, liveAllocations);
+}
 
-  int i{1};
+AT_TEST(shouldPropagateAllocatorOnSwap)
+{
+  std::size_t  liveAllocations{0};
+  CountingTree t1{CountingAllocator<int>{1, &liveAllocations}};
+  CountingTree t2{CountingAllocator<int>{2, &liveAllocations}};
+  t1.insert(1, 1);
 
-  for (Tree::const_iterator it{t.begin()}, end{t.end()}; it != end; it++, ++i) {
-    AT_ASSERT_EQ(i, it->first);
-    AT_ASSERT_EQ(i, it->second);
-  }
+  swap(t1, t2);
+
+  AT_ASSERT_EQ(2, t1.get_allocator().id());
+  AT_ASSERT_EQ(1, t2.get_allocator().id());
+  AT_ASSERT_EQ(true, t1.empty());
+  AT_ASSERT_EQ(1, t2.size());
 }
 
-AT_TEST(shouldBeAbleToIterateBackwardsUsingIterators)
+AT_TEST(shouldReuseErasedNodesFromThePool)
 {
-  Tree t{testTree()};
+  PoolTree                 t{};
+  const PoolTree::iterator first{t.insert(1, 1).first};
+  const int* const         firstAddress{&first->second};
+  t.erase(1);
+
+  const PoolTree::iterator second{t.insert(2, 2).first};
+  AT_ASSERT_EQ(firstAddress, &second->second);
+  AT_ASSERT_EQ(1, t.size());
+  AT_ASSERT_EQ(2, second->second);
+}
 
-  int i{10};
+AT_TEST(shouldBeAbleToReserveAndShrinkPooledTree)
+{
+  PoolTree t{};
+  t.reserve(1000);
 
-  Tree::iterator it{t.end()};
+  for (int i{0}; i < 1000; ++i) {
+    t.insert(i, i);
+  }
+
+  for (int i{0}; i < 1000; i += 2) {
+    t.erase(i);
+  }
+
+  t.shrink_to_fit();
+  AT_ASSERT_EQ(500, t.size());
+
+  for (int i{1}; i < 1000; i += 2) {
+    const PoolTree::iterator it{t.find(i)};
+    AT_ASSERT_NE(t.end(), it);
+    AT_ASSERT_EQ(i, it->second);
+  }
+
+  t.clear();
+  t.shrink_to_fit();
+  t.insert(1, 1);
+  AT_ASSERT_EQ(1, t.size());
+}
+
+AT_TEST(shouldOnlyReleaseAPoolThatIsNotShared)
+{
+  at::PoolAllocator<int> allocator{};
+  allocator.deallocate(allocator.allocate(1), 1);
+  at::PoolAllocator<long> shared{allocator};
+
+  AT_ASSERT_EQ(false, allocator.release());
+  shared = at::PoolAllocator<long>{};
+  AT_ASSERT_EQ(true, allocator.release());
+}
+
+AT_TEST(shouldAlignPooledBlocksWhoseSizeIsNoMultipleOfAPointer)
+{
+  struct Twelve {
+    std::int32_t values[3];
+  };
+
+  at::PoolAllocator<Twelve> allocator{};
+  std::vector<Twelve*>      blocks{};
+
+  for (int i{0}; i < 100; ++i) {
+    blocks.push_back(allocator.allocate(1));
+  }
+
+  for (Twelve* block : blocks) {
+    allocator.deallocate(block, 1);
+  }
+
+  for (Twelve*& block : blocks) {
+    block = allocator.allocate(1);
+    AT_ASSERT_EQ(
+      0U, reinterpret_cast<std::uintptr_t>(block) % alignof(Twelve*));
+    *block = Twelve{{1, 2, 3}};
+  }
+
+  for (Twelve* block : blocks) {
+    AT_ASSERT_EQ(3, block->values[2]);
+    allocator.deallocate(block, 1);
+  }
+}
+
+AT_TEST(shouldBeAbleToClearPooledTreeAtOnce)
+{
+  PoolTree t{};
+
+  for (int i{0}; i < 10'000; ++i) {
+    t.insert(i, i);
+  }
+
+  PoolTree::node_type node{t.extract(5'000)};
+  t.clear();
+  AT_ASSERT_EQ(true, t.empty());
+
+  // The node handle shares the pool, so the nodes were destroyed one by one.
+  AT_ASSERT_EQ(5'000, node.mapped());
+  AT_ASSERT_EQ(true, t.insert(std::move(node)).inserted);
+
+  node = t.extract(5'000);
+  node = PoolTree::node_type{};
+
+  for (int i{0}; i < 10'000; ++i) {
+    t.insert(i, -i);
+  }
+
+  t.clear();
+  t.insert(1, 1);
+  AT_ASSERT_EQ(1U, t.size());
+  AT_ASSERT_EQ(1, t.begin()->second);
+}
+
+AT_TEST(shouldDisposeOfDetachedTreesInTheBackground)
+{
+  constexpr int     nodeCount{3 * at::TreeReclaimer::sliceNodeCount};
+  std::size_t       liveAllocations{0};
+  at::TreeReclaimer reclaimer{};
+
+  {
+    CountingTree t{CountingAllocator<int>{1, &liveAllocations}};
+
+    for (int i{0}; i < nodeCount; ++i) {
+      t.insert(i, i);
+    }
+
+    t.detach_for_disposal(reclaimer);
+    AT_ASSERT_EQ(true, t.empty());
+    AT_ASSERT_EQ(true, t.begin() == t.end());
+    reclaimer.wait_idle();
+    AT_ASSERT_EQ(0, liveAllocations);
+
+    t.insert(1, 1);
+    AT_ASSERT_EQ(1, liveAllocations);
+  }
+
+  AT_ASSERT_EQ(0, liveAllocations);
+}
+
+AT_TEST(shouldKeepUsingDetachedPooledTrees)
+{
+  using PooledStringTree = at::AvlTree<
+    int,
+    std::string,
+    std::less<int>,
+    at::PoolAllocator<std::pair<const int, std::string>>>;
+
+  at::TreeReclaimer             reclaimer{};
+  at::AvlTree<int, std::string> strings{};
+  PooledStringTree              pooledStrings{};
+
+  for (int round{0}; round < 10; ++round) {
+    for (int i{0}; i < 10'000; ++i) {
+      strings.insert(i, std::to_string(i));
+      pooledStrings.insert(i, std::to_string(i));
+    }
+
+    strings.detach_for_disposal(reclaimer);
+    pooledStrings.detach_for_disposal(reclaimer);
+  }
+
+  PoolTree pooled{};
+
+  for (int i{0}; i < 10'000; ++i) {
+    pooled.insert(i, i);
+  }
+
+  pooled.detach_for_disposal(reclaimer);
+  pooled.insert(1, 2);
+  AT_ASSERT_EQ(2, pooled.find(1)->second);
+  reclaimer.wait_idle();
+  AT_ASSERT_EQ(true, strings.empty());
+  AT_ASSERT_EQ(true, pooledStrings.empty());
+}
+
+AT_TEST(shouldNotDisposeOfSharedPoolsInTheBackground)
+{
+  at::TreeReclaimer reclaimer{};
+  PoolTree          lower{};
+
+  for (int i{0}; i < 10'000; ++i) {
+    lower.insert(i, i);
+  }
+
+  // The tree split off shares the pool, which the reclaimer must not touch.
+  PoolTree upper{lower.split(5'000)};
+  lower.detach_for_disposal(reclaimer);
+  AT_ASSERT_EQ(true, lower.empty());
+  AT_ASSERT_EQ(true, lower.get_allocator() == upper.get_allocator());
+
+  for (int i{10'000}; i < 20'000; ++i) {
+    upper.insert(i, i);
+  }
+
+  reclaimer.wait_idle();
+  AT_ASSERT_EQ(15'000U, upper.size());
+  AT_ASSERT_EQ(19'999, std::prev(upper.end())->second);
+}
+
+AT_TEST(shouldGivePooledCopiesAPoolOfTheirOwn)
+{
+  PoolTree t1{};
+  t1.insert(1, 1);
+  PoolTree t2{t1};
+  AT_ASSERT_EQ(false, t1.get_allocator() == t2.get_allocator());
+
+  PoolTree t3{std::move(t1)};
+  AT_ASSERT_EQ(false, t3.get_allocator() == t2.get_allocator());
+  t1.insert(5, 5);
+  AT_ASSERT_EQ(1, t1.size());
+  AT_ASSERT_EQ(1, t3.size());
+}
+
+AT_TEST(shouldBeAbleToFindByKey)
+{
+  const Tree           t{testTree()};
+  Tree::const_iterator p{t.find(4)};
+  AT_ASSERT_NE(t.end(), p);
+  AT_ASSERT_EQ(4, p->second);
+}
+
+AT_TEST(shouldNotBeAbleToFindNonExistantKey)
+{
+  const Tree           t{testTree()};
+  Tree::const_iterator p{t.find(11)};
+  AT_ASSERT_EQ(t.end(), p);
+}
+
+AT_TEST(shouldBeAbleToIterateForwardUsingIterators)
+{
+  Tree t{testTree()};
+
+  int i{1};
+
+  for (Tree::iterator it{t.begin()}, end{t.end()}; it != end; ++it, ++i) {
+    AT_ASSERT_EQ(i, it->first);
+    AT_ASSERT_EQ(i, it->second);
+  }
+}
+
+AT_TEST(shouldBeAbleToPostfixIncrementIterateForwardUsingIterators)
+{
+  Tree t{testTree()};
+
+  int i{1};
+
+  for (Tree::iterator it{t.begin()}, end{t.end()}; it != end; it++, ++i) {
+    AT_ASSERT_EQ(i, it->first);
+    AT_ASSERT_EQ(i, it->second);
+  }
+}
+
+AT_TEST(shouldBeAbleToIterateForwardUsingConstIterators)
+{
+  const Tree t{testTree()};
+
+  int i{1};
+
+  for (Tree::const_iterator it{t.begin()}, end{t.end()}; it != end; ++it, ++i) {
+    AT_ASSERT_EQ(i, it->first);
+    AT_ASSERT_EQ(i, it->second);
+  }
+}
+
+AT_TEST(shouldBeAbleToPostfixIncrementIterateForwardUsingConstIterators)
+{
+  const Tree t{testTree()};
+
+  int i{1};
+
+  for (Tree::const_iterator it{t.begin()}, end{t.end()}; it != end; it++, ++i) {
+    AT_ASSERT_EQ(i, it->first);
+    AT_ASSERT_EQ(i, it->second);
+  }
+}
+
+AT_TEST(shouldBeAbleToIterateBackwardsUsingIterators)
+{
+  Tree t{testTree()};
+
+  int i{10};
+
+  Tree::iterator it{t.end()};
 
   for (Tree::iterator begin{t.begin()}; it != begin; --it) {
     if (it != t.end()) {
@@ -1903,6 +2896,1724 @@ AT_TEST(shouldBeAbleToSustainRandomizedTestWithNoInitialValues)
   }
 }
 
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithPooledTree)
+{
+  std::mt19937_64                    urbg{createURBG()};
+  PoolTree                           t{};
+  std::map<int, int>                 expected{};
+  std::uniform_int_distribution<int> dist{0, 3};
+  std::uniform_int_distribution<int> valueDist{0, 1'000};
+
+  for (int round{0}; round < 100'000; ++round) {
+    const int v{valueDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+      if (valueDist(urbg) == 0) {
+        t.clear();
+        expected.clear();
+        t.shrink_to_fit();
+      }
+      break;
+    case 1:
+      t.insert(v, v);
+      expected.insert({v, v});
+      break;
+    case 2:
+      t.erase(v);
+      expected.erase(v);
+      break;
+    case 3:
+      AT_ASSERT_EQ(expected.count(v) == 1, t.find(v) != t.end());
+      break;
+    }
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+  AT_ASSERT_EQ(
+    true, std::equal(expected.begin(), expected.end(), t.begin(), t.end()));
+}
+
+AT_TEST(shouldBeAbleToIterateTreeWithoutParentLinks)
+{
+  ParentlessTree t{};
+
+  for (int i{0}; i < 100; ++i) {
+    t.insert((i * 37) % 100, i);
+  }
+
+  int expected{0};
+
+  for (const auto& [key, value] : t) {
+    AT_ASSERT_EQ(expected, key);
+    ++expected;
+  }
+
+  for (auto it{t.end()}; it != t.begin();) {
+    --it;
+    --expected;
+    AT_ASSERT_EQ(expected, it->first);
+  }
+
+  AT_ASSERT_EQ(0, expected);
+
+  auto it{t.find(50)};
+  AT_ASSERT_EQ(51, (++it)->first);
+  AT_ASSERT_EQ(50, (--it)->first);
+  AT_ASSERT_EQ(49, (--it)->first);
+}
+
+AT_TEST(shouldReturnNextIteratorOnEraseWithoutParentLinks)
+{
+  ParentlessTree t{{1, 1}, {2, 2}, {3, 3}, {4, 4}, {5, 5}};
+
+  auto it{t.erase(2)};
+  AT_ASSERT_EQ(3, it->first);
+  AT_ASSERT_EQ(4, (++it)->first);
+
+  it = t.erase(5);
+  AT_ASSERT_EQ(true, it == t.end());
+  AT_ASSERT_EQ(4, (--it)->first);
+
+  const auto [inserted, wasInserted]{t.insert(2, 2)};
+  AT_ASSERT_EQ(true, wasInserted);
+  AT_ASSERT_EQ(1, std::prev(inserted)->first);
+  AT_ASSERT_EQ(3, std::next(inserted)->first);
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithoutParentLinks)
+{
+  std::mt19937_64                    urbg{createURBG()};
+  ParentlessTree                     t{};
+  std::map<int, int>                 expected{};
+  std::uniform_int_distribution<int> dist{0, 2};
+  std::uniform_int_distribution<int> valueDist{0, 1'000};
+
+  for (int round{0}; round < 100'000; ++round) {
+    const int v{valueDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+      t.insert(v, v);
+      expected.insert({v, v});
+      break;
+    case 1: {
+      const auto it{t.erase(v)};
+      const auto next{expected.upper_bound(v)};
+
+      if (expected.erase(v) == 0) {
+        break;
+      }
+
+      AT_ASSERT_EQ(next == expected.end(), it == t.end());
+
+      if (it != t.end()) {
+        AT_ASSERT_EQ(next->first, it->first);
+      }
+      break;
+    }
+    case 2:
+      AT_ASSERT_EQ(expected.count(v) == 1, t.find(v) != t.end());
+      break;
+    }
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+  AT_ASSERT_EQ(
+    true, std::equal(expected.begin(), expected.end(), t.begin(), t.end()));
+  AT_ASSERT_EQ(
+    true,
+    std::equal(expected.rbegin(), expected.rend(), t.rbegin(), t.rend()));
+}
+
+AT_TEST(shouldBeAbleToInsertIntoArrayTree)
+{
+  ArrayTree t{};
+
+  for (int i{0}; i < 100; ++i) {
+    AT_ASSERT_EQ(true, t.insert((i * 37) % 100, i).second);
+  }
+
+  AT_ASSERT_EQ(false, t.insert(5, 5).second);
+  AT_ASSERT_EQ(100U, t.size());
+
+  int expected{0};
+
+  for (const auto& [key, value] : t) {
+    AT_ASSERT_EQ(expected, key);
+    AT_ASSERT_EQ(expected, (value * 37) % 100);
+    ++expected;
+  }
+
+  for (auto it{t.end()}; it != t.begin();) {
+    --it;
+    --expected;
+    AT_ASSERT_EQ(expected, it->first);
+  }
+
+  AT_ASSERT_EQ(0, expected);
+  AT_ASSERT_EQ(true, t.find(100) == t.end());
+  t.find(42)->second = -1;
+  AT_ASSERT_EQ(-1, t.find(42)->second);
+}
+
+AT_TEST(shouldPrintArrayTreeLikeAvlTree)
+{
+  ArrayTree t{};
+  Tree      expected{};
+
+  for (int i{0}; i < 20; ++i) {
+    t.insert((i * 7) % 20, i);
+    expected.insert((i * 7) % 20, i);
+  }
+
+  AT_ASSERT_EQ(at::toString(expected), at::toString(t));
+  AT_ASSERT_EQ("Empty ArrayAvlTree"s, at::toString(ArrayTree{}));
+}
+
+AT_TEST(shouldKeepArrayTreeDenseOnErase)
+{
+  ArrayTree t{{1, 1}, {2, 2}, {3, 3}, {4, 4}, {5, 5}};
+
+  auto it{t.erase(2)};
+  AT_ASSERT_EQ(3, it->first);
+  AT_ASSERT_EQ(4U, t.size());
+
+  // 5 was stored last, it is moved into the place of 4.
+  it = t.erase(4);
+  AT_ASSERT_EQ(5, it->first);
+  AT_ASSERT_EQ(5, it->second);
+  AT_ASSERT_EQ(true, ++it == t.end());
+  AT_ASSERT_EQ(true, t.erase(4) == t.end());
+
+  const std::vector<std::pair<int, int>> expected{{1, 1}, {3, 3}, {5, 5}};
+  AT_ASSERT_EQ(
+    true,
+    std::equal(
+      expected.begin(),
+      expected.end(),
+      t.begin(),
+      t.end(),
+      [](const auto& lhs, const auto& rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+      }));
+}
+
+AT_TEST(shouldCopyArrayTreeColumns)
+{
+  ArrayTree t{{1, 1}, {2, 2}, {3, 3}};
+  ArrayTree copy{t};
+
+  copy.insert(4, 4);
+  copy.find(1)->second = 10;
+
+  AT_ASSERT_EQ(3U, t.size());
+  AT_ASSERT_EQ(1, t.find(1)->second);
+  AT_ASSERT_EQ(4U, copy.size());
+  AT_ASSERT_EQ(at::toString(copy), at::toString(ArrayTree{copy}));
+
+  ArrayTree moved{std::move(copy)};
+  AT_ASSERT_EQ(true, copy.empty());
+  AT_ASSERT_EQ(4U, moved.size());
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithArrayTree)
+{
+  std::mt19937_64                    urbg{createURBG()};
+  ArrayTree                          t{};
+  std::map<int, int>                 expected{};
+  std::uniform_int_distribution<int> dist{0, 3};
+  std::uniform_int_distribution<int> valueDist{0, 1'000};
+
+  for (int round{0}; round < 100'000; ++round) {
+    const int v{valueDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+      t.insert_or_assign(v, round);
+      expected.insert_or_assign(v, round);
+      break;
+    case 1:
+      t.insert(v, v);
+      expected.insert({v, v});
+      break;
+    case 2: {
+      const auto it{t.erase(v)};
+      const auto next{expected.upper_bound(v)};
+
+      if (expected.erase(v) == 0) {
+        break;
+      }
+
+      AT_ASSERT_EQ(next == expected.end(), it == t.end());
+
+      if (it != t.end()) {
+        AT_ASSERT_EQ(next->first, it->first);
+      }
+      break;
+    }
+    case 3:
+      AT_ASSERT_EQ(expected.count(v) == 1, t.find(v) != t.end());
+      break;
+    }
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+  AT_ASSERT_EQ(
+    true,
+    std::equal(
+      expected.begin(),
+      expected.end(),
+      t.begin(),
+      t.end(),
+      [](const auto& lhs, const auto& rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+      }));
+}
+
+AT_TEST(shouldLinkElementsIntoIntrusiveTree)
+{
+  std::vector<Item> items{};
+
+  for (int i{0}; i < 50; ++i) {
+    items.emplace_back((i * 13) % 50, std::to_string(i));
+  }
+
+  IntrusiveTree t{};
+
+  for (Item& item : items) {
+    const auto [it, inserted]{t.insert(item)};
+    AT_ASSERT_EQ(true, inserted);
+    AT_ASSERT_EQ(&item, &*it);
+  }
+
+  Item       duplicate{7, "duplicate"};
+  const auto result{t.insert(duplicate)};
+  AT_ASSERT_EQ(false, result.second);
+  AT_ASSERT_EQ(&items[39], &*result.first);
+  AT_ASSERT_EQ(50U, t.size());
+
+  int expected{0};
+
+  for (const Item& item : t) {
+    AT_ASSERT_EQ(expected, item.key);
+    ++expected;
+  }
+
+  for (auto it{t.rbegin()}; it != t.rend(); ++it) {
+    --expected;
+    AT_ASSERT_EQ(expected, it->key);
+  }
+
+  AT_ASSERT_EQ("9"s, t.find(17)->name);
+  AT_ASSERT_EQ(true, t.find(50) == t.end());
+}
+
+AT_TEST(shouldMoveElementsBetweenIntrusiveTrees)
+{
+  std::vector<Item> items{{1, "a"}, {2, "b"}, {3, "c"}, {4, "d"}};
+  IntrusiveTree     even{};
+  IntrusiveTree     odd{};
+
+  for (Item& item : items) {
+    even.insert(item);
+  }
+
+  for (Item& item : items) {
+    if (item.key % 2 != 0) {
+      even.erase(item.key);
+      odd.insert(item);
+    }
+  }
+
+  AT_ASSERT_EQ("|=====2\n|\n|\n4"s, at::toString(even));
+  AT_ASSERT_EQ("1\n|\n|\n|=====3"s, at::toString(odd));
+
+  auto it{odd.erase(odd.begin())};
+  AT_ASSERT_EQ(3, it->key);
+  AT_ASSERT_EQ(1U, odd.size());
+
+  // Re-keying an element that is in no tree.
+  items[0].key = 5;
+  AT_ASSERT_EQ(true, odd.insert(items[0]).second);
+  AT_ASSERT_EQ(5, std::prev(odd.end())->key);
+
+  // Moving a tree onto itself keeps its elements linked.
+  IntrusiveTree& self{even};
+  even = std::move(self);
+  AT_ASSERT_EQ(2U, even.size());
+  AT_ASSERT_EQ(2, even.begin()->key);
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithIntrusiveTree)
+{
+  std::mt19937_64                    urbg{createURBG()};
+  std::vector<Item>                  items{};
+  IntrusiveTree                      t{};
+  std::set<int>                      expected{};
+  std::uniform_int_distribution<int> dist{0, 2};
+  std::uniform_int_distribution<int> valueDist{0, 999};
+
+  for (int i{0}; i < 1'000; ++i) {
+    items.emplace_back(i, std::string{});
+  }
+
+  for (int round{0}; round < 100'000; ++round) {
+    const int v{valueDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+      AT_ASSERT_EQ(expected.insert(v).second, t.insert(items[v]).second);
+      break;
+    case 1: {
+      const auto it{t.erase(v)};
+      const auto next{expected.upper_bound(v)};
+
+      if (expected.erase(v) == 0) {
+        break;
+      }
+
+      AT_ASSERT_EQ(next == expected.end(), it == t.end());
+
+      if (it != t.end()) {
+        AT_ASSERT_EQ(*next, it->key);
+      }
+      break;
+    }
+    case 2:
+      AT_ASSERT_EQ(expected.count(v) == 1, t.find(v) != t.end());
+      break;
+    }
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+  AT_ASSERT_EQ(
+    true,
+    std::equal(
+      expected.begin(),
+      expected.end(),
+      t.begin(),
+      t.end(),
+      [](int key, const Item& item) { return key == item.key; }));
+}
+
+AT_TEST(shouldStoreOnlyKeysInSet)
+{
+  Set t{5, 3, 8, 3};
+  AT_ASSERT_EQ(3, t.size());
+  AT_ASSERT_EQ(false, t.insert(5).second);
+  AT_ASSERT_EQ(true, t.insert(4).second);
+  AT_ASSERT_EQ(4, *t.find(4));
+  AT_ASSERT_EQ(t.end(), t.find(7));
+
+  const std::vector<int> expected{3, 4, 5, 8};
+  AT_ASSERT_EQ(
+    true, std::equal(expected.begin(), expected.end(), t.begin(), t.end()));
+  AT_ASSERT_EQ(5, *t.erase(4));
+  AT_ASSERT_EQ(true, (std::is_same_v<const int&, decltype(*t.begin())>));
+
+  std::ostringstream oss{};
+  oss << t;
+  AT_ASSERT_EQ("|=====3\n|\n|\n5\n|\n|\n|=====8"s, oss.str());
+
+  Set::node_type node{t.extract(3)};
+  node.value() = 9;
+  AT_ASSERT_EQ(true, t.insert(std::move(node)).inserted);
+  AT_ASSERT_EQ(9, *std::prev(t.end()));
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithSet)
+{
+  std::mt19937_64                    urbg{createURBG()};
+  std::vector<int>                   sorted(500);
+  std::uniform_int_distribution<int> dist{0, 2};
+  std::uniform_int_distribution<int> valueDist{0, 999};
+
+  for (int i{0}; i < 500; ++i) {
+    sorted[static_cast<std::size_t>(i)] = 2 * i;
+  }
+
+  Set           t{sorted.begin(), sorted.end()};
+  std::set<int> expected{sorted.begin(), sorted.end()};
+
+  for (int round{0}; round < 100'000; ++round) {
+    const int v{valueDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+      AT_ASSERT_EQ(expected.insert(v).second, t.insert(v).second);
+      break;
+    case 1:
+      expected.erase(v);
+      t.erase(v);
+      break;
+    case 2:
+      AT_ASSERT_EQ(expected.count(v) == 1, t.find(v) != t.end());
+      break;
+    }
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+  AT_ASSERT_EQ(
+    true,
+    std::equal(expected.begin(), expected.end(), t.begin(), t.end()));
+
+  const Set copy{t};
+  AT_ASSERT_EQ(
+    true, std::equal(copy.begin(), copy.end(), t.begin(), t.end()));
+}
+
+AT_TEST(shouldKeepEquivalentKeysInInsertionOrder)
+{
+  Multimap t{{2, 0}, {1, 1}, {2, 2}};
+  AT_ASSERT_EQ(true, t.insert(2, 3).second);
+  AT_ASSERT_EQ(true, t.emplace(2, 4).second);
+  AT_ASSERT_EQ(5, t.size());
+  AT_ASSERT_EQ(4, t.count(2));
+  AT_ASSERT_EQ(0, t.count(3));
+
+  const auto             range{t.equal_range(2)};
+  const std::vector<int> expected{0, 2, 3, 4};
+  AT_ASSERT_EQ(
+    true,
+    std::equal(
+      expected.begin(),
+      expected.end(),
+      range.first,
+      range.second,
+      [](int value, const auto& element) { return value == element.second; }));
+  AT_ASSERT_EQ(t.end(), range.second);
+  AT_ASSERT_EQ(t.equal_range(3).first, t.equal_range(3).second);
+
+  Multimap::node_type node{t.extract(2)};
+  AT_ASSERT_EQ(0, node.mapped());
+  t.insert(std::move(node));
+  AT_ASSERT_EQ(0, std::prev(t.end())->second);
+
+  at::AvlMultiset<int> s{3, 1, 3, 3};
+  AT_ASSERT_EQ(4, s.size());
+  AT_ASSERT_EQ(3, s.count(3));
+}
+
+AT_TEST(shouldEraseAllEquivalentKeysAtOnce)
+{
+  Multimap t{};
+
+  for (int i{0}; i < 100; ++i) {
+    t.insert(i % 4, i);
+  }
+
+  const Multimap::iterator it{t.erase(2)};
+  AT_ASSERT_EQ(75, t.size());
+  AT_ASSERT_EQ(0, t.count(2));
+  AT_ASSERT_EQ(3, it->first);
+  AT_ASSERT_EQ(3, it->second);
+  AT_ASSERT_EQ(t.end(), t.erase(3));
+  AT_ASSERT_EQ(t.end(), t.erase(2));
+  AT_ASSERT_EQ(50, t.size());
+
+  // Like the unique trees, erasing an absent key returns end().
+  t.insert(5, 5);
+  AT_ASSERT_EQ(t.end(), t.erase(2));
+
+  ParentlessMultimap parentless{{1, 1}, {3, 3}, {3, 4}};
+  AT_ASSERT_EQ(parentless.end(), parentless.erase(2));
+  AT_ASSERT_EQ(3U, parentless.size());
+  AT_ASSERT_EQ(3, parentless.erase(1)->first);
+  AT_ASSERT_EQ(parentless.end(), parentless.erase(3));
+}
+
+template<typename Tree>
+void multimapRandomizedTest()
+{
+  std::mt19937_64                    urbg{createURBG()};
+  Tree                               t{};
+  std::multimap<int, int>            expected{};
+  std::uniform_int_distribution<int> dist{0, 4};
+  std::uniform_int_distribution<int> keyDist{0, 99};
+
+  for (int round{0}; round < 50'000; ++round) {
+    const int key{keyDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+    case 1:
+      expected.emplace(key, round);
+      AT_ASSERT_EQ(key, t.insert(key, round).first->first);
+      break;
+    case 2: {
+      const auto next{expected.count(key) == 0 ? expected.end()
+                                               : expected.upper_bound(key)};
+      const auto it{t.erase(key)};
+      expected.erase(key);
+      AT_ASSERT_EQ(next == expected.end(), it == t.end());
+
+      if (it != t.end()) {
+        AT_ASSERT_EQ(next->second, it->second);
+      }
+      break;
+    }
+    case 3: {
+      const std::size_t count{expected.count(key)};
+      AT_ASSERT_EQ(count, t.count(key));
+
+      if (count == 0) {
+        break;
+      }
+
+      std::uniform_int_distribution<std::ptrdiff_t> offsetDist{
+        0, static_cast<std::ptrdiff_t>(count) - 1};
+      const std::ptrdiff_t offset{offsetDist(urbg)};
+      const auto           expectedIt{
+        std::next(expected.lower_bound(key), offset)};
+      const auto it{std::next(t.equal_range(key).first, offset)};
+      AT_ASSERT_EQ(expectedIt->second, t.extract(it).mapped());
+      expected.erase(expectedIt);
+      break;
+    }
+    case 4:
+      AT_ASSERT_EQ(expected.count(key), t.count(key));
+      break;
+    }
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+  AT_ASSERT_EQ(
+    true,
+    std::equal(
+      expected.begin(),
+      expected.end(),
+      t.begin(),
+      t.end(),
+      [](const auto& lhs, const auto& rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+      }));
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithMultimap)
+{
+  multimapRandomizedTest<Multimap>();
+  multimapRandomizedTest<ParentlessMultimap>();
+}
+
+AT_TEST(shouldLookUpKeysOfOtherTypesWithTransparentComparator)
+{
+  StringTree             t{{"apple", 1}, {"banana", 2}, {"cherry", 3}};
+  const StringTree&      constTree{t};
+  const std::string_view banana{"banana"};
+
+  AT_ASSERT_EQ(2, t.find(banana)->second);
+  AT_ASSERT_EQ(3, constTree.find(std::string_view{"cherry"})->second);
+  AT_ASSERT_EQ(t.end(), t.find(std::string_view{"date"}));
+  AT_ASSERT_EQ(true, constTree.contains(banana));
+  AT_ASSERT_EQ(false, constTree.contains(std::string_view{"date"}));
+  AT_ASSERT_EQ(1, constTree.count(banana));
+  AT_ASSERT_EQ(t.find(banana), t.equal_range(banana).first);
+  AT_ASSERT_EQ("cherry"s, t.erase(banana)->first);
+  AT_ASSERT_EQ(2, t.size());
+  AT_ASSERT_EQ(false, t.contains("banana"s));
+
+  at::AvlMultiset<std::string, StringViewLess> s{"a", "b", "b"};
+  AT_ASSERT_EQ(2, s.count(std::string_view{"b"}));
+  AT_ASSERT_EQ(s.end(), s.erase(std::string_view{"b"}));
+  AT_ASSERT_EQ(1, s.size());
+}
+
+AT_TEST(shouldUseTheComparatorGivenToTheTree)
+{
+  const std::vector<std::pair<int, int>> values{{1, 1}, {3, 3}, {2, 2}};
+  DirectedTree t{values.begin(), values.end(), DirectedLess{true}};
+  AT_ASSERT_EQ(3, t.begin()->first);
+  AT_ASSERT_EQ(1, std::prev(t.end())->first);
+  AT_ASSERT_EQ(true, t.key_comp()(2, 1));
+  AT_ASSERT_EQ(true, t.value_comp()(*t.begin(), *std::prev(t.end())));
+  AT_ASSERT_EQ(2, t.find(2)->second);
+
+  const DirectedTree copy{t};
+  AT_ASSERT_EQ(3, copy.begin()->first);
+
+  DirectedTree ascending{{{5, 5}, {4, 4}}};
+  ascending.swap(t);
+  AT_ASSERT_EQ(4, t.begin()->first);
+  AT_ASSERT_EQ(3, ascending.begin()->first);
+  AT_ASSERT_EQ(true, ascending.insert(4, 4).second);
+  AT_ASSERT_EQ(4, ascending.begin()->first);
+}
+
+AT_TEST(shouldUseTheComparatorGivenToArrayAndIntrusiveTrees)
+{
+  at::ArrayAvlTree<int, int, DirectedLess> array{
+    {{1, 1}, {3, 3}, {2, 2}}, DirectedLess{true}};
+  AT_ASSERT_EQ(3, array.begin()->first);
+  AT_ASSERT_EQ(true, array.key_comp()(2, 1));
+  AT_ASSERT_EQ(2, array.find(2)->second);
+  AT_ASSERT_EQ(1, array.erase(2)->first);
+
+  at::ArrayAvlTree<int, int, DirectedLess> movedArray{std::move(array)};
+  AT_ASSERT_EQ(true, movedArray.insert(4, 4).second);
+  AT_ASSERT_EQ(4, movedArray.begin()->first);
+
+  std::vector<Item> items{};
+
+  for (int i{1}; i <= 3; ++i) {
+    items.emplace_back(i, std::to_string(i));
+  }
+
+  at::IntrusiveAvlTree<Item, KeyOfItem, DirectedLess> intrusive{
+    DirectedLess{true}};
+
+  for (Item& item : items) {
+    intrusive.insert(item);
+  }
+
+  AT_ASSERT_EQ(3, intrusive.begin()->key);
+  AT_ASSERT_EQ(true, intrusive.key_comp()(2, 1));
+  AT_ASSERT_EQ("2"s, intrusive.find(2)->name);
+  AT_ASSERT_EQ(1, intrusive.erase(2)->key);
+
+  at::IntrusiveAvlTree<Item, KeyOfItem, DirectedLess> movedIntrusive{
+    std::move(intrusive)};
+  AT_ASSERT_EQ(true, movedIntrusive.insert(items[1]).second);
+  AT_ASSERT_EQ(2, std::next(movedIntrusive.begin())->key);
+}
+
+AT_TEST(shouldCompareOncePerLevelWithThreeWayComparator)
+{
+  std::size_t                             lessCount{0};
+  std::size_t                             compare3Count{0};
+  at::AvlTree<int, int, CountingCompare3> t{
+    CountingCompare3{&lessCount, &compare3Count}};
+  ArrayTree                               arrayTree{};
+
+  for (int i{0}; i < 1000; ++i) {
+    const int key{(i * 7919) % 1000};
+    t.insert(key, i);
+    arrayTree.insert(key, i);
+  }
+
+  AT_ASSERT_EQ(0, lessCount);
+
+  // A tree of 1000 nodes is at most 14 levels high.
+  compare3Count = 0;
+  AT_ASSERT_EQ(true, t.find(500) != t.end());
+  AT_ASSERT_EQ(true, compare3Count <= 14);
+  AT_ASSERT_EQ(t.end(), t.find(1000));
+
+  for (int key{0}; key < 1000; key += 2) {
+    t.erase(key);
+  }
+
+  AT_ASSERT_EQ(0, lessCount);
+  AT_ASSERT_EQ(500, t.size());
+  AT_ASSERT_EQ(1, t.count(999));
+  AT_ASSERT_EQ(0, t.count(998));
+  AT_ASSERT_EQ(true, arrayTree.find(998) != arrayTree.end());
+}
+
+AT_TEST(shouldNotSearchAgainForTheReturnedIteratorWithoutParentLinks)
+{
+  std::size_t lessCount{0};
+  std::size_t compare3Count{0};
+  at::AvlTree<
+    int,
+    int,
+    CountingCompare3,
+    std::allocator<std::pair<const int, int>>,
+    WithoutParentLinks>
+    t{CountingCompare3{&lessCount, &compare3Count}};
+
+  for (int i{0}; i < 1000; i += 2) {
+    t.insert((i * 7919) % 1000, i);
+  }
+
+  // A tree of up to 1000 nodes is at most 14 levels high.
+  compare3Count = 0;
+  auto inserted{t.insert(501, 0)};
+  AT_ASSERT_EQ(true, inserted.second);
+  AT_ASSERT_EQ(true, compare3Count <= 14);
+  AT_ASSERT_EQ(502, (++inserted.first)->first);
+
+  compare3Count = 0;
+  const auto next{t.erase(500)};
+  AT_ASSERT_EQ(true, compare3Count <= 14);
+  AT_ASSERT_EQ(501, next->first);
+  AT_ASSERT_EQ(498, std::prev(next)->first);
+  AT_ASSERT_EQ(0, lessCount);
+}
+
+AT_TEST(shouldOrderByASpecializedStdLess)
+{
+  at::AvlTree<ReversedKey, int> t{};
+
+  for (int i{0}; i < 100; ++i) {
+    t.insert(ReversedKey{(i * 37) % 100}, i);
+  }
+
+  AT_ASSERT_EQ(99, t.begin()->first.value);
+  AT_ASSERT_EQ(0, std::prev(t.end())->first.value);
+
+  for (int i{0}; i < 100; ++i) {
+    AT_ASSERT_EQ(i, t.find(ReversedKey{i})->first.value);
+  }
+
+  AT_ASSERT_EQ(49, t.erase(ReversedKey{50})->first.value);
+  AT_ASSERT_EQ(t.end(), t.find(ReversedKey{50}));
+}
+
+AT_TEST(shouldInsertNextToHint)
+{
+  std::size_t                             lessCount{0};
+  std::size_t                             compare3Count{0};
+  at::AvlTree<int, int, CountingCompare3> t{
+    CountingCompare3{&lessCount, &compare3Count}};
+
+  for (int i{0}; i < 1000; ++i) {
+    AT_ASSERT_EQ(i, t.emplace_hint(t.end(), i, i)->first);
+  }
+
+  // Appending with end() as hint compares with the last element only.
+  AT_ASSERT_EQ(999, lessCount);
+
+  lessCount = 0;
+  auto it{t.begin()};
+
+  for (int i{-1}; i > -1000; --i) {
+    it = t.insert(it, {i, i});
+  }
+
+  AT_ASSERT_EQ(true, lessCount <= 2 * 999);
+  AT_ASSERT_EQ(1999, t.size());
+  AT_ASSERT_EQ(-999, t.begin()->first);
+  AT_ASSERT_EQ(true, std::is_sorted(t.begin(), t.end()));
+
+  // Hints that are off still insert in the right place.
+  AT_ASSERT_EQ(5000, t.insert(t.begin(), {5000, 0})->first);
+  AT_ASSERT_EQ(5000, std::prev(t.end())->first);
+  AT_ASSERT_EQ(500, t.emplace_hint(t.end(), 500, -1)->second);
+  AT_ASSERT_EQ(2000, t.size());
+}
+
+template<typename Tree, typename Expected>
+void hintRandomizedTest()
+{
+  std::mt19937_64                    urbg{createURBG()};
+  Tree                               t{};
+  Expected                           expected{};
+  std::uniform_int_distribution<int> dist{0, 5};
+  std::uniform_int_distribution<int> keyDist{0, 999};
+  auto                               hint{t.end()};
+
+  for (int round{0}; round < 50'000; ++round) {
+    const int key{keyDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0: // Right next to the last insertion.
+      hint = t.emplace_hint(std::next(hint, hint != t.end()), key, round);
+      expected.emplace(key, round);
+      break;
+    case 1: // Somewhere near the right place, if at all.
+      hint = t.insert(t.find(key + 1), {key, round});
+      expected.emplace(key, round);
+      break;
+    case 2: // At either end, which the tree keeps track of.
+      hint = t.emplace_hint(key % 2 == 0 ? t.begin() : t.end(), key, round);
+      expected.emplace(key, round);
+      break;
+    case 3:
+      t.erase(key);
+      expected.erase(key);
+      hint = t.begin();
+      continue;
+    case 4: {
+      Tree upper{t.split(key)};
+      t.join(std::move(upper));
+      hint = t.end();
+      continue;
+    }
+    case 5: {
+      Tree other{std::move(t)};
+      t = std::move(other);
+      hint = t.end();
+      continue;
+    }
+    }
+
+    AT_ASSERT_EQ(key, hint->first);
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+  AT_ASSERT_EQ(
+    true,
+    std::equal(
+      expected.begin(),
+      expected.end(),
+      t.begin(),
+      t.end(),
+      [](const auto& lhs, const auto& rhs) {
+        return lhs.first == rhs.first;
+      }));
+}
+
+template<typename Tree>
+void multimapHintTest()
+{
+  const std::multimap<int, int> initial{
+    {1, 0}, {2, 1}, {2, 2}, {2, 3}, {4, 4}, {4, 5}};
+
+  // Every hint before, within and after the runs of equal keys.
+  for (int key{0}; key <= 5; ++key) {
+    for (std::size_t index{0}; index <= initial.size(); ++index) {
+      std::multimap<int, int> expected{initial};
+      Tree                    t{};
+
+      for (const auto& [k, value] : initial) {
+        t.insert(k, value);
+      }
+
+      const auto expectedIt{expected.emplace_hint(
+        std::next(expected.begin(), index), key, -1)};
+      const auto it{t.emplace_hint(std::next(t.begin(), index), key, -1)};
+      AT_ASSERT_EQ(
+        std::distance(expected.begin(), expectedIt),
+        std::distance(t.begin(), it));
+      AT_ASSERT_EQ(
+        true,
+        std::equal(
+          expected.begin(),
+          expected.end(),
+          t.begin(),
+          t.end(),
+          [](const auto& lhs, const auto& rhs) {
+            return lhs.first == rhs.first && lhs.second == rhs.second;
+          }));
+    }
+  }
+}
+
+AT_TEST(shouldInsertNextToHintLikeStdMultimap)
+{
+  multimapHintTest<Multimap>();
+  multimapHintTest<ParentlessMultimap>();
+
+  // The previous result as hint, runs of equal keys go in front of it.
+  Multimap                t{};
+  std::multimap<int, int> expected{};
+  auto                    it{t.end()};
+  auto                    expectedIt{expected.end()};
+
+  for (int i{0}; i < 100; ++i) {
+    it         = t.emplace_hint(it, i / 10, i);
+    expectedIt = expected.emplace_hint(expectedIt, i / 10, i);
+    AT_ASSERT_EQ(expectedIt->second, it->second);
+  }
+
+  AT_ASSERT_EQ(
+    true,
+    std::equal(
+      expected.begin(),
+      expected.end(),
+      t.begin(),
+      t.end(),
+      [](const auto& lhs, const auto& rhs) {
+        return lhs.second == rhs.second;
+      }));
+}
+
+AT_TEST(shouldReturnTheInsertedElementForMovedKeysWithHints)
+{
+  using ParentlessMultiset = at::AvlMultiset<
+    std::string,
+    std::less<std::string>,
+    std::allocator<std::string>,
+    WithoutParentLinks>;
+  const std::string apple(32, 'a');
+  const std::string banana(32, 'b');
+  const std::string cherry(32, 'c');
+
+  // The hint is too far ahead and the moved from key can't find the element.
+  ParentlessMultiset s{apple, banana, cherry};
+  std::string        key{cherry};
+  auto               it{s.insert(s.begin(), std::move(key))};
+  AT_ASSERT_EQ(cherry, *it);
+  AT_ASSERT_EQ(2, std::distance(s.begin(), it));
+  AT_ASSERT_EQ(banana, *std::prev(it));
+  AT_ASSERT_EQ(cherry, *++it);
+
+  key = banana;
+  it  = s.insert(s.lower_bound(cherry), std::move(key));
+  AT_ASSERT_EQ(banana, *it);
+  AT_ASSERT_EQ(2, std::distance(s.begin(), it));
+  AT_ASSERT_EQ(banana, *std::prev(it));
+  AT_ASSERT_EQ(cherry, *++it);
+
+  // Runs of equal keys appended with a hint keep their iterators usable.
+  ParentlessMultimap t{};
+  auto               tIt{t.end()};
+
+  for (int i{0}; i < 1000; ++i) {
+    tIt = t.emplace_hint(t.end(), 7, i);
+    AT_ASSERT_EQ(i, tIt->second);
+    AT_ASSERT_EQ(true, ++tIt == t.end());
+  }
+
+  tIt = t.emplace_hint(t.begin(), 7, -1);
+  AT_ASSERT_EQ(-1, tIt->second);
+  AT_ASSERT_EQ(0, (++tIt)->second);
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithHints)
+{
+  hintRandomizedTest<Tree, std::map<int, int>>();
+  hintRandomizedTest<ParentlessTree, std::map<int, int>>();
+  hintRandomizedTest<Multimap, std::multimap<int, int>>();
+  hintRandomizedTest<ParentlessMultimap, std::multimap<int, int>>();
+}
+
+AT_TEST(shouldFindBounds)
+{
+  Tree        t{{10, 1}, {20, 2}, {30, 3}, {40, 4}};
+  const Tree& constTree{t};
+
+  AT_ASSERT_EQ(10, t.lower_bound(5)->first);
+  AT_ASSERT_EQ(20, t.lower_bound(20)->first);
+  AT_ASSERT_EQ(30, t.upper_bound(20)->first);
+  AT_ASSERT_EQ(30, constTree.lower_bound(25)->first);
+  AT_ASSERT_EQ(constTree.end(), constTree.upper_bound(40));
+  AT_ASSERT_EQ(t.end(), t.lower_bound(41));
+
+  const auto [first, last]{constTree.equal_range(30)};
+  AT_ASSERT_EQ(30, first->first);
+  AT_ASSERT_EQ(40, last->first);
+  AT_ASSERT_EQ(t.lower_bound(15), t.equal_range(15).first);
+  AT_ASSERT_EQ(t.lower_bound(15), t.equal_range(15).second);
+
+  // [20, 40) is 20 and 30.
+  std::vector<int> keys{};
+
+  for (auto it{t.lower_bound(20)}; it != t.lower_bound(40); ++it) {
+    keys.push_back(it->first);
+  }
+
+  AT_ASSERT_EQ(true, (keys == std::vector<int>{20, 30}));
+
+  StringTree strings{{"apple", 1}, {"banana", 2}, {"cherry", 3}};
+  AT_ASSERT_EQ(2, strings.lower_bound(std::string_view{"b"})->second);
+  AT_ASSERT_EQ(3, strings.upper_bound(std::string_view{"banana"})->second);
+}
+
+template<typename Tree>
+void boundsRandomizedTest()
+{
+  std::mt19937_64                    urbg{createURBG()};
+  Tree                               t{};
+  std::multimap<int, int>            expected{};
+  std::uniform_int_distribution<int> keyDist{0, 199};
+
+  for (int round{0}; round < 2'000; ++round) {
+    const int key{keyDist(urbg)};
+    t.insert(key, round);
+    expected.emplace(key, round);
+  }
+
+  for (int key{-1}; key <= 200; ++key) {
+    const auto [first, last]{t.equal_range(key)};
+    AT_ASSERT_EQ(
+      std::distance(expected.begin(), expected.lower_bound(key)),
+      std::distance(t.begin(), t.lower_bound(key)));
+    AT_ASSERT_EQ(
+      std::distance(expected.begin(), expected.upper_bound(key)),
+      std::distance(t.begin(), t.upper_bound(key)));
+    AT_ASSERT_EQ(t.lower_bound(key), first);
+    AT_ASSERT_EQ(t.upper_bound(key), last);
+    AT_ASSERT_EQ(
+      expected.count(key),
+      static_cast<std::size_t>(std::distance(first, last)));
+
+    // Iterators from a bound move on both ways.
+    if (first != t.end()) {
+      AT_ASSERT_EQ(first, std::prev(std::next(first)));
+    }
+
+    if (last != t.begin()) {
+      AT_ASSERT_EQ(last, std::next(std::prev(last)));
+    }
+  }
+}
+
+AT_TEST(shouldFindBoundsLikeStdMultimap)
+{
+  boundsRandomizedTest<Multimap>();
+  boundsRandomizedTest<ParentlessMultimap>();
+}
+
+AT_TEST(shouldFindElementsByIndexWithOrderStatistics)
+{
+  RankedTree t{};
+
+  for (int i{0}; i < 100; ++i) {
+    t.insert(2 * i, i);
+  }
+
+  const RankedTree& constTree{t};
+
+  for (int i{0}; i < 100; ++i) {
+    AT_ASSERT_EQ(2 * i, t.nth(i)->first);
+    AT_ASSERT_EQ(static_cast<std::size_t>(i), t.rank(2 * i));
+    AT_ASSERT_EQ(static_cast<std::size_t>(i + 1), t.rank(2 * i + 1));
+  }
+
+  AT_ASSERT_EQ(t.end(), t.nth(100));
+  AT_ASSERT_EQ(0, constTree.rank(-5));
+  AT_ASSERT_EQ(100, constTree.rank(500));
+  AT_ASSERT_EQ(50, constTree.nth(25)->first);
+
+  // [10, 20) holds 10, 12, 14, 16 and 18.
+  AT_ASSERT_EQ(5, t.count_range(10, 20));
+  AT_ASSERT_EQ(5, t.count_range(9, 19));
+  AT_ASSERT_EQ(0, t.count_range(20, 10));
+  AT_ASSERT_EQ(100, t.count_range(-1, 1000));
+
+  auto it{t.begin() + 10};
+  AT_ASSERT_EQ(20, it->first);
+  it -= 3;
+  AT_ASSERT_EQ(14, it->first);
+  AT_ASSERT_EQ(t.end(), it + 93);
+  AT_ASSERT_EQ(198, (t.end() - 1)->first);
+  AT_ASSERT_EQ(100, t.end() - t.begin());
+  AT_ASSERT_EQ(-7, t.begin() - it);
+  AT_ASSERT_EQ(60, (constTree.begin() + 30)->first);
+  AT_ASSERT_EQ(100, constTree.end() - constTree.begin());
+
+  std::mt19937_64 urbg{createURBG()};
+  std::set<int>   sampled{};
+
+  for (int i{0}; i < 2'000; ++i) {
+    sampled.insert(t.sample(urbg)->first);
+  }
+
+  AT_ASSERT_EQ(100, sampled.size());
+  AT_ASSERT_EQ(RankedTree{}.end(), RankedTree{}.sample(urbg));
+}
+
+AT_TEST(shouldKeepEndIteratorsUsableWhenTheRootChanges)
+{
+  RankedTree t{{0, 0}, {1, 1}};
+  const auto end{t.end()};
+
+  // Inserting 2 already rotates the root.
+  for (int i{2}; i < 100; ++i) {
+    t.insert(i, i);
+  }
+
+  AT_ASSERT_EQ(100, end - t.begin());
+  AT_ASSERT_EQ(99, (end - 1)->first);
+  AT_ASSERT_EQ(90, (end + -10)->first);
+  AT_ASSERT_EQ(99, std::prev(end)->first);
+  AT_ASSERT_EQ(end, t.begin() + 100);
+}
+
+template<typename Tree, typename Expected>
+void orderStatisticsRandomizedTest()
+{
+  std::mt19937_64                    urbg{createURBG()};
+  Tree                               t{};
+  Expected                           expected{};
+  std::uniform_int_distribution<int> dist{0, 5};
+  std::uniform_int_distribution<int> keyDist{0, 499};
+
+  for (int round{0}; round < 20'000; ++round) {
+    const int key{keyDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+    case 1:
+      t.insert(key, round);
+      expected.emplace(key, round);
+      break;
+    case 2:
+      t.insert(t.lower_bound(key), {key, round});
+      expected.emplace(key, round);
+      break;
+    case 3:
+      t.erase(key);
+      expected.erase(key);
+      break;
+    case 4:
+      if (t.contains(key)) {
+        t.extract(t.find(key));
+        expected.erase(expected.find(key));
+      }
+      break;
+    case 5: {
+      const auto low{static_cast<int>(key * 0.9)};
+      AT_ASSERT_EQ(
+        static_cast<std::size_t>(
+          std::distance(expected.begin(), expected.lower_bound(key))),
+        t.rank(key));
+      AT_ASSERT_EQ(
+        static_cast<std::size_t>(
+          std::distance(expected.lower_bound(low), expected.lower_bound(key))),
+        t.count_range(low, key));
+      break;
+    }
+    }
+
+    AT_ASSERT_EQ(
+      expected.size(), static_cast<std::size_t>(t.end() - t.begin()));
+
+    if (t.empty()) {
+      continue;
+    }
+
+    std::uniform_int_distribution<std::size_t> indexDist{0, t.size() - 1};
+    const std::size_t                          index{indexDist(urbg)};
+    const auto                                 it{t.nth(index)};
+    AT_ASSERT_EQ(std::next(expected.begin(), index)->first, it->first);
+    AT_ASSERT_EQ(index, static_cast<std::size_t>(it - t.begin()));
+    AT_ASSERT_EQ(t.end(), it + (t.size() - index));
+    AT_ASSERT_EQ(t.begin(), it - index);
+  }
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithOrderStatistics)
+{
+  orderStatisticsRandomizedTest<RankedTree, std::map<int, int>>();
+  orderStatisticsRandomizedTest<
+    ParentlessRankedMultimap,
+    std::multimap<int, int>>();
+}
+
+AT_TEST(shouldAggregateRangesOfKeys)
+{
+  SummingTree t{};
+
+  for (int i{1}; i <= 100; ++i) {
+    t.insert(i, i);
+  }
+
+  AT_ASSERT_EQ(5050, t.aggregate());
+  AT_ASSERT_EQ(55, t.aggregate(1, 11));
+  AT_ASSERT_EQ(50, t.aggregate(50, 51));
+  AT_ASSERT_EQ(0, t.aggregate(50, 50));
+  AT_ASSERT_EQ(0, t.aggregate(200, 300));
+  AT_ASSERT_EQ(5050, t.aggregate(-5, 500));
+
+  t.modify(t.find(50), [](int& value) { value = 0; });
+  AT_ASSERT_EQ(5000, t.aggregate());
+  AT_ASSERT_EQ(0, t.find(50)->second);
+  t.insert_or_assign(50, 1000);
+  AT_ASSERT_EQ(6000, t.aggregate());
+  t.erase(50);
+  AT_ASSERT_EQ(5000, t.aggregate());
+
+  const SummingTree copy{t};
+  AT_ASSERT_EQ(5000, copy.aggregate());
+  AT_ASSERT_EQ(0, SummingTree{}.aggregate());
+
+  // The aggregate of the lower keys always goes first.
+  ConcatenatingSet s{"a", "b", "c", "d", "e", "f"};
+  AT_ASSERT_EQ("abcdef"s, s.aggregate());
+  AT_ASSERT_EQ("bcd"s, s.aggregate("b", "e"));
+  AT_ASSERT_EQ("def"s, s.aggregate("cc", "z"));
+}
+
+template<typename Tree, typename Expected>
+void aggregateRandomizedTest()
+{
+  std::mt19937_64                    urbg{createURBG()};
+  Tree                               t{};
+  Expected                           expected{};
+  std::uniform_int_distribution<int> dist{0, 5};
+  std::uniform_int_distribution<int> keyDist{0, 499};
+  std::uniform_int_distribution<int> valueDist{-1000, 1000};
+
+  for (int round{0}; round < 20'000; ++round) {
+    const int key{keyDist(urbg)};
+    const int value{valueDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+    case 1:
+      t.insert(key, value);
+      expected.emplace(key, value);
+      break;
+    case 2:
+      t.insert(t.lower_bound(key), {key, value});
+      expected.emplace_hint(expected.lower_bound(key), key, value);
+      break;
+    case 3:
+      t.erase(key);
+      expected.erase(key);
+      break;
+    case 4:
+      if (t.contains(key)) {
+        t.modify(t.lower_bound(key), [value](int& mapped) { mapped = value; });
+        expected.lower_bound(key)->second = value;
+      }
+      break;
+    case 5: {
+      const int high{key + valueDist(urbg) / 10};
+      long long sum{0};
+
+      for (auto it{expected.lower_bound(key)};
+           it != expected.end() && it->first < high;
+           ++it) {
+        sum += it->second;
+      }
+
+      AT_ASSERT_EQ(sum, t.aggregate(key, high));
+      break;
+    }
+    }
+  }
+
+  long long sum{0};
+
+  for (const auto& [key, value] : expected) {
+    sum += value;
+  }
+
+  AT_ASSERT_EQ(sum, t.aggregate());
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithAggregates)
+{
+  aggregateRandomizedTest<SummingTree, std::map<int, int>>();
+  aggregateRandomizedTest<
+    ParentlessSummingMultimap,
+    std::multimap<int, int>>();
+}
+
+AT_TEST(shouldApplyChangesToRangesOfKeys)
+{
+  AffineTree t{};
+
+  for (int i{1}; i <= 10; ++i) {
+    t.insert(i, i);
+  }
+
+  // x -> 2x + 1 for [3, 6).
+  t.range_apply(3, 6, AffineChange{2, 1});
+  AT_ASSERT_EQ(70, t.aggregate().first);
+  AT_ASSERT_EQ(10, t.aggregate().second);
+  AT_ASSERT_EQ(2, t.find(2)->second);
+  AT_ASSERT_EQ(7, t.find(3)->second);
+  AT_ASSERT_EQ(11, t.find(5)->second);
+  AT_ASSERT_EQ(6, t.find(6)->second);
+
+  // Then x -> -x for [5, 100), which has to go after the first change.
+  t.range_apply(5, 100, AffineChange{-1, 0});
+  AT_ASSERT_EQ(-11, t.find(5)->second);
+  AT_ASSERT_EQ(-11 - 6 - 7 - 8 - 9 - 10, t.aggregate(5, 100).first);
+  AT_ASSERT_EQ(6, t.aggregate(5, 100).second);
+  AT_ASSERT_EQ(1 + 2 + 7 + 9, t.aggregate(0, 5).first);
+
+  const AffineTree copy{t};
+  std::vector<int> values{};
+
+  for (const auto& [key, value] : copy) {
+    values.push_back(value);
+  }
+
+  AT_ASSERT_EQ(
+    true, (values == std::vector<int>{1, 2, 7, 9, -11, -6, -7, -8, -9, -10}));
+
+  t.range_apply(7, 3, AffineChange{0, 0});
+  AT_ASSERT_EQ(-7, t.find(7)->second);
+}
+
+template<typename Tree, typename Expected>
+void rangeUpdateRandomizedTest()
+{
+  std::mt19937_64                    urbg{createURBG()};
+  Tree                               t{};
+  Expected                           expected{};
+  std::uniform_int_distribution<int> dist{0, 7};
+  std::uniform_int_distribution<int> keyDist{0, 299};
+  std::uniform_int_distribution<int> valueDist{-5, 5};
+
+  for (int round{0}; round < 20'000; ++round) {
+    const int key{keyDist(urbg)};
+    const int value{valueDist(urbg)};
+    const int high{key + keyDist(urbg) / 4};
+
+    switch (dist(urbg)) {
+    case 0:
+      t.insert(key, value);
+      expected.emplace(key, value);
+      break;
+    case 1:
+      t.insert(t.lower_bound(key), {key, value});
+      expected.emplace_hint(expected.lower_bound(key), key, value);
+      break;
+    case 2:
+      t.erase(key);
+      expected.erase(key);
+      break;
+    case 3:
+      if (t.contains(key)) {
+        AT_ASSERT_EQ(
+          expected.lower_bound(key)->second,
+          t.extract(t.lower_bound(key)).mapped());
+        expected.erase(expected.lower_bound(key));
+      }
+      break;
+    case 4:
+    case 5: {
+      const AffineChange change{value < 0 ? -1 : 1, value};
+      t.range_apply(key, high, change);
+
+      for (auto it{expected.lower_bound(key)};
+           it != expected.end() && it->first < high;
+           ++it) {
+        it->second = change.factor * it->second + change.offset;
+      }
+      break;
+    }
+    case 6: {
+      SumAndCount::value_type aggregate{0, 0};
+
+      for (auto it{expected.lower_bound(key)};
+           it != expected.end() && it->first < high;
+           ++it) {
+        aggregate.first += it->second;
+        ++aggregate.second;
+      }
+
+      AT_ASSERT_EQ(aggregate.first, t.aggregate(key, high).first);
+      AT_ASSERT_EQ(aggregate.second, t.aggregate(key, high).second);
+      break;
+    }
+    case 7:
+      if (t.contains(key)) {
+        AT_ASSERT_EQ(
+          expected.lower_bound(key)->second, t.lower_bound(key)->second);
+      }
+      break;
+    }
+  }
+
+  const Tree copy{t};
+  AT_ASSERT_EQ(expected.size(), copy.size());
+  AT_ASSERT_EQ(
+    true,
+    std::equal(
+      expected.begin(),
+      expected.end(),
+      copy.begin(),
+      copy.end(),
+      [](const auto& lhs, const auto& rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+      }));
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithRangeUpdates)
+{
+  rangeUpdateRandomizedTest<AffineTree, std::map<int, int>>();
+  rangeUpdateRandomizedTest<
+    ParentlessAffineMultimap,
+    std::multimap<int, int>>();
+}
+
+template<typename Tree>
+std::vector<int> containing(const Tree& t, int point)
+{
+  std::vector<int> values{};
+  t.for_each_containing(point, [&values](const auto& element) {
+    values.push_back(element.second);
+  });
+  return values;
+}
+
+template<typename Tree>
+std::vector<int> overlapping(const Tree& t, at::Interval<int> interval)
+{
+  std::vector<int> values{};
+  t.for_each_overlapping(interval, [&values](const auto& element) {
+    values.push_back(element.second);
+  });
+  return values;
+}
+
+AT_TEST(shouldFindIntervalsContainingPoints)
+{
+  IntervalTree t{
+    {{1, 3}, 0}, {{2, 8}, 1}, {{4, 5}, 2}, {{6, 6}, 3}, {{9, 12}, 4}};
+  AT_ASSERT_EQ(5, t.size());
+  AT_ASSERT_EQ(true, containing(t, 0).empty());
+  AT_ASSERT_EQ(true, (containing(t, 3) == std::vector<int>{0, 1}));
+  AT_ASSERT_EQ(true, (containing(t, 6) == std::vector<int>{1, 3}));
+  AT_ASSERT_EQ(true, (containing(t, 12) == std::vector<int>{4}));
+  AT_ASSERT_EQ(true, containing(t, 13).empty());
+  AT_ASSERT_EQ(true, (overlapping(t, {5, 9}) == std::vector<int>{1, 2, 3, 4}));
+  AT_ASSERT_EQ(true, (overlapping(t, {-2, 1}) == std::vector<int>{0}));
+  AT_ASSERT_EQ(true, overlapping(t, {13, 20}).empty());
+
+  // The greatest end has to follow the erase of the interval that held it.
+  t.erase({2, 8});
+  AT_ASSERT_EQ(true, containing(t, 7).empty());
+  AT_ASSERT_EQ(true, (containing(t, 4) == std::vector<int>{2}));
+
+  t.insert({2, 8}, 5);
+  t.insert({2, 8}, 6);
+  AT_ASSERT_EQ(true, (containing(t, 7) == std::vector<int>{5, 6}));
+  t.modify(t.find({9, 12}), [](int& value) { value = 7; });
+  AT_ASSERT_EQ(true, (containing(t, 10) == std::vector<int>{7}));
+}
+
+template<typename Tree>
+void intervalTreeRandomizedTest()
+{
+  std::mt19937_64                    urbg{createURBG()};
+  Tree                               t{};
+  std::vector<std::pair<int, int>>   expected{};
+  std::uniform_int_distribution<int> dist{0, 4};
+  std::uniform_int_distribution<int> pointDist{0, 999};
+  std::uniform_int_distribution<int> lengthDist{0, 40};
+
+  for (int round{0}; round < 10'000; ++round) {
+    const int start{pointDist(urbg)};
+    const int end{start + lengthDist(urbg)};
+
+    switch (dist(urbg)) {
+    case 0:
+    case 1:
+      t.insert({start, end}, round);
+      expected.emplace_back(start, end);
+      break;
+    case 2:
+      t.erase({start, end});
+      std::erase(expected, std::pair<int, int>{start, end});
+      break;
+    case 3: {
+      std::ptrdiff_t count{0};
+
+      t.for_each_containing(start, [&count, start](const auto& element) {
+        AT_ASSERT_EQ(true, element.first.start <= start);
+        AT_ASSERT_EQ(true, start <= element.first.end);
+        ++count;
+      });
+
+      AT_ASSERT_EQ(
+        std::count_if(
+          expected.begin(),
+          expected.end(),
+          [start](const auto& e) {
+            return e.first <= start && start <= e.second;
+          }),
+        count);
+      break;
+    }
+    case 4: {
+      std::ptrdiff_t count{0};
+      int            previousStart{-1};
+
+      t.for_each_overlapping(
+        {start, end}, [&count, &previousStart](const auto& element) {
+          AT_ASSERT_EQ(true, previousStart <= element.first.start);
+          previousStart = element.first.start;
+          ++count;
+        });
+
+      AT_ASSERT_EQ(
+        std::count_if(
+          expected.begin(),
+          expected.end(),
+          [start, end](const auto& e) {
+            return e.first <= end && start <= e.second;
+          }),
+        count);
+      break;
+    }
+    }
+  }
+
+  AT_ASSERT_EQ(expected.size(), t.size());
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithIntervals)
+{
+  intervalTreeRandomizedTest<IntervalTree>();
+  intervalTreeRandomizedTest<ParentlessIntervalTree>();
+}
+
+AT_TEST(shouldSplitAndJoinTrees)
+{
+  Tree t{};
+
+  for (int i{0}; i < 100; ++i) {
+    t.insert(i, i * 2);
+  }
+
+  Tree upper{t.split(60)};
+  AT_ASSERT_EQ(60U, t.size());
+  AT_ASSERT_EQ(40U, upper.size());
+  AT_ASSERT_EQ(59, std::prev(t.end())->first);
+  AT_ASSERT_EQ(60, upper.begin()->first);
+  AT_ASSERT_EQ(true, std::is_sorted(t.begin(), t.end()));
+  AT_ASSERT_EQ(120, upper.find(60)->second);
+  AT_ASSERT_EQ(t.end(), t.find(60));
+
+  // Dropping everything older than 20.
+  t = t.split(20);
+  AT_ASSERT_EQ(40U, t.size());
+  AT_ASSERT_EQ(20, t.begin()->first);
+
+  try {
+    upper.join(std::move(t));
+    AT_ASSERT_EQ(false, true);
+  }
+  catch (const std::invalid_argument& ex) {
+    AT_ASSERT_EQ("AvlTree::join: the keys of the trees overlap!"s, ex.what());
+  }
+
+  t.join(std::move(upper));
+  AT_ASSERT_EQ(80U, t.size());
+  AT_ASSERT_EQ(0U, upper.size());
+  AT_ASSERT_EQ(true, upper.empty());
+  AT_ASSERT_EQ(80, std::distance(t.begin(), t.end()));
+  AT_ASSERT_EQ(198, t.find(99)->second);
+  AT_ASSERT_EQ(0U, t.split(1000).size());
+  AT_ASSERT_EQ(80U, t.split(-1).size());
+  AT_ASSERT_EQ(0U, t.size());
+
+  Multimap m{{1, 1}, {2, 2}, {2, 3}, {2, 4}, {3, 5}};
+  Multimap twos{m.split(2)};
+  Multimap threes{twos.split(3)};
+  AT_ASSERT_EQ(1U, m.size());
+  AT_ASSERT_EQ(3U, twos.count(2));
+  AT_ASSERT_EQ(1U, threes.size());
+  m.join(std::move(twos));
+  m.join(std::move(threes));
+  AT_ASSERT_EQ(5U, m.size());
+  AT_ASSERT_EQ(2, m.lower_bound(2)->second);
+  AT_ASSERT_EQ(5, std::prev(m.end())->second);
+
+  // Joining a tree with itself leaves it as it is.
+  Multimap single{{1, 1}};
+  single.join(std::move(single));
+  AT_ASSERT_EQ(1U, single.size());
+  AT_ASSERT_EQ(1, std::distance(single.begin(), single.end()));
+  t.insert(1, 1);
+  t.join(std::move(t));
+  AT_ASSERT_EQ(1U, t.size());
+
+  RankedTree ranked{};
+
+  for (int i{0}; i < 50; ++i) {
+    ranked.insert(i, i);
+  }
+
+  RankedTree rankedUpper{ranked.split(17)};
+  AT_ASSERT_EQ(17U, ranked.size());
+  AT_ASSERT_EQ(33U, rankedUpper.size());
+  AT_ASSERT_EQ(20, rankedUpper.nth(3)->first);
+  AT_ASSERT_EQ(16, ranked.nth(16)->first);
+}
+
+static long long sumOf(long long aggregate)
+{
+  return aggregate;
+}
+
+static long long sumOf(const SumAndCount::value_type& aggregate)
+{
+  return aggregate.first;
+}
+
+template<typename Tree, typename Expected>
+void splitJoinRandomizedTest()
+{
+  std::mt19937_64                    urbg{createURBG()};
+  std::uniform_int_distribution<int> keyDist{0, 999};
+  std::uniform_int_distribution<int> sizeDist{0, 500};
+  auto                               sameElements{
+    [](const auto& tree, auto first, auto last) {
+      return std::equal(
+        first,
+        last,
+        tree.begin(),
+        tree.end(),
+        [](const auto& lhs, const auto& rhs) {
+          return lhs.first == rhs.first && lhs.second == rhs.second;
+        });
+    }};
+
+  for (int round{0}; round < 500; ++round) {
+    Tree     t{};
+    Expected expected{};
+
+    for (int i{0}, count{sizeDist(urbg)}; i < count; ++i) {
+      const int key{keyDist(urbg)};
+      t.insert(key, i);
+      expected.emplace(key, i);
+    }
+
+    const int split{keyDist(urbg)};
+    Tree      upper{t.split(split)};
+    AT_ASSERT_EQ(expected.size(), t.size() + upper.size());
+    AT_ASSERT_EQ(
+      true,
+      sameElements(t, expected.begin(), expected.lower_bound(split)));
+    AT_ASSERT_EQ(
+      true,
+      sameElements(upper, expected.lower_bound(split), expected.end()));
+
+    // Both parts have to go on working as trees of their own.
+    const int key{keyDist(urbg)};
+    (key < split ? t : upper).insert(key, -1);
+    expected.emplace(key, -1);
+    const int erased{keyDist(urbg)};
+    (erased < split ? t : upper).erase(erased);
+    expected.erase(erased);
+
+    if constexpr (requires { upper.range_apply(0, 1, AffineChange{1, 0}); }) {
+      upper.range_apply(split, split + 100, AffineChange{3, -1});
+
+      for (auto it{expected.lower_bound(split)};
+           it != expected.end() && it->first < split + 100;
+           ++it) {
+        it->second = 3 * it->second - 1;
+      }
+    }
+
+    t.join(std::move(upper));
+    AT_ASSERT_EQ(true, upper.empty());
+    AT_ASSERT_EQ(expected.size(), t.size());
+    AT_ASSERT_EQ(true, sameElements(t, expected.begin(), expected.end()));
+
+    if constexpr (requires { t.nth(0); }) {
+      for (std::size_t i{0}; i < t.size(); i += 7) {
+        AT_ASSERT_EQ(std::next(expected.begin(), i)->first, t.nth(i)->first);
+      }
+    }
+
+    if constexpr (requires { t.aggregate(); }) {
+      long long sum{0};
+
+      for (const auto& [k, value] : expected) {
+        sum += value;
+      }
+
+      AT_ASSERT_EQ(sum, sumOf(t.aggregate()));
+    }
+  }
+}
+
+AT_TEST(shouldBeAbleToSustainRandomizedTestWithSplitAndJoin)
+{
+  splitJoinRandomizedTest<Tree, std::map<int, int>>();
+  splitJoinRandomizedTest<ParentlessMultimap, std::multimap<int, int>>();
+  splitJoinRandomizedTest<RankedTree, std::map<int, int>>();
+  splitJoinRandomizedTest<
+    ParentlessRankedMultimap,
+    std::multimap<int, int>>();
+  splitJoinRandomizedTest<
+    ParentlessSummingMultimap,
+    std::multimap<int, int>>();
+  splitJoinRandomizedTest<AffineTree, std::map<int, int>>();
+}
+
 AT_TEST(shouldSustainRandomizedIteratorTest)
 {
   std::mt19937_64 urbg{createURBG()};